@@ -46,10 +46,29 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
   double frequency = (config_.rpm / 60.0);     // expected Hz rate
 
   // default number of packets for each scan is a single revolution
-  // (fractions rounded up)
+  // (fractions rounded up), and follows the rotation rate measured
+  // once the device is switched to another one, unless given
   config_.npackets = (int) ceil(packet_rate / frequency);
-  private_nh.getParam("npackets", config_.npackets);
+  config_.fixed_npackets = private_nh.getParam("npackets", config_.npackets);
   ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+  rotation_.reset(config_.rpm);
+
+  // scan_per_revolution publishes each revolution, from the packet
+  // crossing start_angle, as one scan instead
+  double start_angle;
+  private_nh.param("scan_per_revolution", config_.scan_per_revolution, false);
+  private_nh.param("start_angle", start_angle, 0.0);
+  config_.start_angle = int(start_angle * 100);
+  last_azimuth_ = -1;
+  filled_ = 0;
+  if (config_.scan_per_revolution)
+    ROS_INFO("publishing a scan per revolution, starting at %.2f degrees",
+             start_angle);
+
+  // the scans held by subscribers, plus the one being filled
+  scan_pool_.reset(new ScanPool(4, 16, config_.scan_per_revolution ?
+                                config_.npackets + config_.npackets / 4 :
+                                config_.npackets / 3));
 
   std::string dump_file;
   private_nh.param("pcap", dump_file, std::string(""));
@@ -67,7 +86,9 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
 
   // initialize diagnostics
   diagnostics_.setHardwareID(deviceName);
-  const double diag_freq = packet_rate/config_.npackets;
+  // poll() publishes a third of npackets at a time, or a revolution
+  const double diag_freq = config_.scan_per_revolution ?
+    frequency : packet_rate/(config_.npackets / 3);
   diag_max_freq_ = diag_freq;
   diag_min_freq_ = diag_freq;
   ROS_INFO("expected frequency: %.3f (Hz)", diag_freq);
@@ -149,55 +170,162 @@ int HS_L40_GPS_Parse(HS_LIDAR_L40_GPS_Packet *packet , const unsigned char* recv
     return 0;
 }
 
+/** read the next LiDAR packet, publishing the GPS packets on the way
+ *
+ *  @returns 0 if a packet was read, -1 at end of file
+ */
+int PandarDriver::getPacket(pandar_msgs::PandarPacket *packet)
+{
+  while (true)
+    {
+      // keep reading until full packet received
+      int rc = input_->getPacket(packet, config_.time_offset);
+      if (rc == 0)              // got a full packet?
+        {
+          if (rotation_.add(*packet))
+            followRotationRate();
+          return 0;
+        }
+      if (rc == 2)
+      {
+        // gps packet;
+        HS_LIDAR_L40_GPS_Packet gpsPacket;
+        if(HS_L40_GPS_Parse( &gpsPacket , &packet->data[0] , HS_LIDAR_L40_GPS_PACKET_SIZE) == 0)
+        {
+          pandar_msgs::PandarGpsPtr gps(new pandar_msgs::PandarGps);
+          gps->stamp = ros::Time::now();
+
+          gps->year = gpsPacket.year;
+          gps->month = gpsPacket.month;
+          gps->day = gpsPacket.day;
+          gps->hour = gpsPacket.hour;
+          gps->minute = gpsPacket.minute;
+          gps->second = gpsPacket.second;
+
+          gps->used = 0;
+
+          gpsoutput_.publish(gps);
+        }
+        
+      }
+      if (rc < 0) return -1;    // end of file reached?
+    }
+}
+
 /** poll the device
  *
  *  @returns true unless end of file reached
  */
 bool PandarDriver::poll(void)
 {
+  if (config_.scan_per_revolution)
+    return pollRevolution();
+
   int readpacket = config_.npackets / 3;
-  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-  pandar_msgs::PandarScanPtr scan(new pandar_msgs::PandarScan);
+  // A shared pointer for zero-copy sharing with other nodelets,
+  // recycled once they all released it.
+  pandar_msgs::PandarScanPtr scan = scan_pool_->get();
   scan->packets.resize(readpacket);
 
   // Since the pandar delivers data at a very high rate, keep
   // reading and publishing scans as fast as possible.
   for (int i = 0; i < readpacket; ++i)
     {
-      while (true)
+      if (getPacket(&scan->packets[i]) < 0)
+        return false;
+    }
+
+  publishScan(scan);
+  return true;
+}
+
+/** read packets until a revolution is complete, and publish it
+ *
+ *  The packet in which the rotation crosses start_angle opens the next
+ *  scan, so a scan starts at most one packet before start_angle and
+ *  holds no block of the following revolution.  Consumers can decode
+ *  each scan on its own.
+ *
+ *  @returns true unless end of file reached
+ */
+bool PandarDriver::pollRevolution(void)
+{
+  // a revolution that never ends: the device stopped rotating
+  const size_t max_packets = 2 * config_.npackets;
+  while (true)
+    {
+      if (!scan_)
+        {
+          scan_ = scan_pool_->get();
+          filled_ = 0;
+        }
+      // recycled scans keep their packets, reuse them
+      if (filled_ == scan_->packets.size())
+        scan_->packets.resize(filled_ + 1);
+      pandar_msgs::PandarPacket &packet = scan_->packets[filled_];
+      if (getPacket(&packet) < 0)
+        return false;
+
+      if (pandar_msgs::crossesStartAngle(last_azimuth_, packet,
+                                         config_.start_angle)
+          && filled_ > 0)
+        {
+          pandar_msgs::PandarScanPtr next = scan_pool_->get();
+          if (next->packets.empty())
+            next->packets.resize(1);
+          next->packets[0] = packet;
+          scan_->packets.resize(filled_);
+          publishScan(scan_);
+          scan_ = next;
+          filled_ = 1;
+          return true;
+        }
+      if (++filled_ >= max_packets)
         {
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i], config_.time_offset);
-          if (rc == 0) break;       // got a full packet?
-          if (rc == 2)
-          {
-            // gps packet;
-            HS_LIDAR_L40_GPS_Packet packet;
-            if(HS_L40_GPS_Parse( &packet , &scan->packets[i].data[0] , HS_LIDAR_L40_GPS_PACKET_SIZE) == 0)
-            {
-              pandar_msgs::PandarGpsPtr gps(new pandar_msgs::PandarGps);
-              gps->stamp = ros::Time::now();
-
-              gps->year = packet.year;
-              gps->month = packet.month;
-              gps->day = packet.day;
-              gps->hour = packet.hour;
-              gps->minute = packet.minute;
-              gps->second = packet.second;
-
-              gps->used = 0;
-
-              gpsoutput_.publish(gps);
-            }
-            
-          }
-          if (rc < 0) return false; // end of file reached?
+          ROS_WARN_THROTTLE(10, "no revolution start in %zu packets",
+                            max_packets);
+          scan_->packets.resize(filled_);
+          publishScan(scan_);
+          scan_.reset();
+          return true;
         }
     }
+}
 
+/** resize what depends on the rotation rate, once a new one was
+ *  measured
+ *
+ *  npackets and the packets reserved in scans follow the packets per
+ *  revolution, unless npackets was given.
+ */
+void PandarDriver::followRotationRate(void)
+{
+  config_.rpm = rotation_.rpm();
+  int revolution = rotation_.packetsPerRevolution();
+  ROS_INFO("rotating at %.0f RPM (measured %.1f), %d packets per revolution",
+           config_.rpm, rotation_.measuredRpm(), revolution);
+  if (!config_.fixed_npackets)
+    {
+      config_.npackets = revolution;
+      scan_pool_->setPackets(config_.scan_per_revolution ?
+                             config_.npackets + config_.npackets / 4 :
+                             config_.npackets / 3);
+      ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+    }
+
+  // the packet rate doubles with dual return, the revolutions do not
+  double frequency = config_.rpm / 60.0;
+  const double diag_freq = config_.scan_per_revolution ?
+    frequency : frequency * revolution / (config_.npackets / 3);
+  diag_max_freq_ = diag_freq;
+  diag_min_freq_ = diag_freq;
+}
+
+void PandarDriver::publishScan(const pandar_msgs::PandarScanPtr &scan)
+{
   // publish message using time of last packet read
   ROS_DEBUG("Publishing a full Pandar scan.");
-  scan->header.stamp = scan->packets[readpacket - 1].stamp;
+  scan->header.stamp = scan->packets.back().stamp;
   scan->header.frame_id = config_.frame_id;
   output_.publish(scan);
 
@@ -205,8 +333,6 @@ bool PandarDriver::poll(void)
   // its status
   diag_topic_->tick(scan->header.stamp);
   diagnostics_.update();
-
-  return true;
 }
 
 void PandarDriver::callback(pandar_driver::PandarNodeConfig &config,
@@ -23,11 +23,15 @@
 #include <dynamic_reconfigure/server.h>
 
 #include <pandar_driver/input.h>
+#include <pandar_msgs/PandarScan.h>
+#include <pandar_msgs/rotation_rate.h>
+#include <pandar_msgs/scan_pool.h>
 #include <pandar_driver/PandarNodeConfig.h>
 
 
 namespace pandar_driver
 {
+using pandar_msgs::ScanPool;
 
 class PandarDriver
 {
@@ -41,6 +45,11 @@ public:
 
 private:
 
+  int getPacket(pandar_msgs::PandarPacket *packet);
+  bool pollRevolution(void);
+  void followRotationRate(void);
+  void publishScan(const pandar_msgs::PandarScanPtr &scan);
+
   ///Callback for dynamic reconfigure
   void callback(pandar_driver::PandarNodeConfig &config,
               uint32_t level);
@@ -55,10 +64,26 @@ private:
     std::string frame_id;            ///< tf frame ID
     std::string model;               ///< device model name
     int    npackets;                 ///< number of packets to collect
+    bool   fixed_npackets;           ///< npackets given, not measured
     double rpm;                      ///< device rotation rate (RPMs)
     double time_offset;              ///< time in seconds added to each pandar time stamp
+    bool scan_per_revolution;        ///< cut scans where a revolution starts
+    int start_angle;                 ///< where it starts, 1/100 degree
   } config_;
 
+  /** scans are recycled once subscribers released them, so that the
+      poll loop does not allocate */
+  boost::shared_ptr<ScanPool> scan_pool_;
+
+  /** with scan_per_revolution: the revolution being filled, and the
+      azimuth of the last block read */
+  pandar_msgs::PandarScanPtr scan_;
+  size_t filled_;
+  int last_azimuth_;
+
+  /** rotation rate measured from the packets read, npackets follows it */
+  pandar_msgs::RotationRate rotation_;
+
   boost::shared_ptr<Input> input_;
   ros::Publisher output_;
   ros::Publisher gpsoutput_;
@@ -13,6 +13,7 @@
  */
 
 #include <string>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 
 #include <ros/ros.h>
@@ -34,8 +35,9 @@ public:
 
   ~DriverNodelet()
   {
-    if (running_)
+    if (deviceThread_)
       {
+        // the thread sees it within one input poll timeout
         NODELET_INFO("shutting down driver thread");
         running_ = false;
         deviceThread_->join();
@@ -48,7 +50,7 @@ private:
   virtual void onInit(void);
   virtual void devicePoll(void);
 
-  volatile bool running_;               ///< device thread is running
+  boost::atomic<bool> running_;         ///< cleared to stop the device thread
   boost::shared_ptr<boost::thread> deviceThread_;
 
   boost::shared_ptr<PandarDriver> dvr_; ///< driver implementation class
@@ -68,11 +70,10 @@ void DriverNodelet::onInit()
 /** @brief Device poll thread main loop. */
 void DriverNodelet::devicePoll()
 {
-  while(ros::ok())
+  // poll device until end of file or shutdown
+  while (running_ && ros::ok())
     {
-      // poll device until end of file
-      running_ = dvr_->poll();
-      if (!running_)
+      if (!dvr_->poll())
         break;
     }
   running_ = false;
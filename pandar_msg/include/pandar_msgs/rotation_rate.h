@@ -0,0 +1,286 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Rotation of a Pandar40, from its raw packets: the frame
+ *  boundary rule and the rotation rate, shared by pandar_driver and
+ *  pandar_pointcloud.
+ */
+
+#ifndef __PANDAR_MSGS_ROTATION_RATE_H
+#define __PANDAR_MSGS_ROTATION_RATE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pandar_msgs/PandarPacket.h>
+
+namespace pandar_msgs
+{
+/** layout of the raw packet fields read here, see pandar_rawdata */
+static const int PACKET_BLOCKS = 6;
+static const int PACKET_BLOCK_SIZE = 204;
+static const int PACKET_AZIMUTH_OFFSET = 2;
+static const int PACKET_TIMESTAMP_OFFSET = PACKET_BLOCKS * PACKET_BLOCK_SIZE + 10;
+
+/** azimuth of block @c block of a raw packet, 1/100 degree */
+inline int blockAzimuth(const PandarPacket &packet, int block)
+{
+    const uint8_t *p = &packet.data[block * PACKET_BLOCK_SIZE +
+                                    PACKET_AZIMUTH_OFFSET];
+    return p[0] | p[1] << 8;
+}
+
+/** timestamp of a raw packet, microseconds since the pulse */
+inline uint32_t packetUsec(const PandarPacket &packet)
+{
+    const uint8_t *p = &packet.data[PACKET_TIMESTAMP_OFFSET];
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/** \brief Whether the rotation crosses @c startAngle from the block
+ *  azimuth @c lastAzimuth to the next, @c azimuth.
+ *
+ *  The frame boundary rule of the drivers and of RawData: a block
+ *  that steps backwards by less than half a turn arrived out of
+ *  order, crosses nothing and leaves @c lastAzimuth at the furthest
+ *  azimuth seen.  Otherwise @c lastAzimuth becomes @c azimuth.
+ *
+ *  @param lastAzimuth of the previous block, -1 before the first
+ *  @param startAngle 1/100 degree
+ */
+inline bool crossesStartAngle(int &lastAzimuth, int azimuth, int startAngle)
+{
+    if (lastAzimuth < 0)
+    {
+        lastAzimuth = azimuth;
+        return false;
+    }
+
+    bool crossed;
+    if (lastAzimuth > azimuth)
+    {
+        if (lastAzimuth - azimuth <= 18000)
+        {
+            // out of order, keep the furthest azimuth seen
+            return false;
+        }
+        crossed = startAngle <= azimuth;
+    }
+    else
+    {
+        crossed = lastAzimuth < startAngle && startAngle <= azimuth;
+    }
+    lastAzimuth = azimuth;
+    return crossed;
+}
+
+/** \brief Whether the rotation crosses @c startAngle within a raw
+ *  packet, or between the previous packet and this one.
+ */
+inline bool crossesStartAngle(int &lastAzimuth, const PandarPacket &packet,
+                              int startAngle)
+{
+    bool crossed = false;
+    for (int j = 0; j < PACKET_BLOCKS; ++j)
+    {
+        if (crossesStartAngle(lastAzimuth, blockAzimuth(packet, j),
+                              startAngle))
+            crossed = true;
+    }
+    return crossed;
+}
+
+/** \brief Measures how fast the device turns, and how many packets
+ *  a revolution takes.
+ *
+ *  The azimuth of the first block of each packet, against the packet
+ *  timestamp, gives the rotation rate over windows of WINDOW_USEC.
+ *  Packets out of order, and gaps in the timestamps, restart the
+ *  window.  The rate is rounded to the nearest of the device settings
+ *  (300, 600 or 1200 RPM) when it is within a tenth of one, and the
+ *  packets per revolution follow from the packet rate measured over
+ *  the same window, so dual return doubles them.
+ *
+ *  A new rate is only taken once CONFIRM_WINDOWS windows in a row
+ *  agree on it: the sizes derived from it change once per switch.
+ *  Not thread safe.
+ */
+class RotationRate
+{
+public:
+
+    /** microseconds of packets measured at a time */
+    static const int WINDOW_USEC = 50000;
+    /** windows agreeing before a new rate is taken */
+    static const int CONFIRM_WINDOWS = 2;
+    /** packet rate of the Pandar40 in single return mode (Hz) */
+    static const int PACKET_RATE = 3000;
+
+    /** @param rpm rate assumed until one is measured */
+    explicit RotationRate(double rpm = 600.0)
+    {
+        reset(rpm);
+    }
+
+    /** \brief Forget the measurements, and assume @c rpm again. */
+    void reset(double rpm)
+    {
+        if (rpm < MIN_RPM)
+            rpm = 600.0;
+        rpm_ = rpm;
+        packets_ = (int) ceil(PACKET_RATE * 60.0 / rpm);
+        measured_ = 0.0;
+        changes_ = 0;
+        lastAzimuth_ = -1;
+        lastUsec_ = 0;
+        candidates_ = 0;
+        restart();
+    }
+
+    /** \brief Measure one more packet.
+     *
+     *  @param azimuth of its first block, 1/100 degree
+     *  @param usec its timestamp, microseconds since the pulse
+     *  @returns true when the rate, or the packets per revolution,
+     *           changed
+     */
+    bool add(int azimuth, uint32_t usec)
+    {
+        if (lastAzimuth_ < 0)
+        {
+            lastAzimuth_ = azimuth;
+            lastUsec_ = usec;
+            return false;
+        }
+
+        // a packet stepping backwards arrived out of order: measure
+        // the next one from the packet before it
+        int step = (azimuth - lastAzimuth_ + 36000) % 36000;
+        if (step > 18000)
+            return false;
+        int64_t usecs = (int64_t) usec - lastUsec_;
+        if (usecs < 0)
+            usecs += 1000000;            // the pulse restarted the count
+        lastAzimuth_ = azimuth;
+        lastUsec_ = usec;
+        if (usecs <= 0 || usecs > MAX_GAP_USEC)
+        {
+            restart();
+            return false;
+        }
+
+        windowAzimuth_ += step;
+        windowUsec_ += usecs;
+        windowPackets_++;
+        if (windowUsec_ < WINDOW_USEC)
+            return false;
+
+        double seconds = windowUsec_ * 1e-6;
+        measured_ = windowAzimuth_ / 36000.0 / seconds * 60.0;
+        double packetRate = windowPackets_ / seconds;
+        restart();
+        if (measured_ < MIN_RPM)
+            return false;                // not rotating, nothing to size
+
+        double rpm = nominalRpm(measured_);
+        int packets = (int) ceil(packetRate * 60.0 / rpm - 0.5);
+        if (rpm == rpm_ && samePackets(packets, packets_))
+        {
+            candidates_ = 0;
+            return false;
+        }
+        if (candidates_ > 0 && rpm == candidateRpm_
+            && samePackets(packets, candidatePackets_))
+            candidates_++;
+        else
+        {
+            candidateRpm_ = rpm;
+            candidatePackets_ = packets;
+            candidates_ = 1;
+        }
+        if (candidates_ < CONFIRM_WINDOWS)
+            return false;
+
+        rpm_ = candidateRpm_;
+        packets_ = candidatePackets_;
+        changes_++;
+        candidates_ = 0;
+        return true;
+    }
+
+    bool add(const PandarPacket &packet)
+    {
+        return add(blockAzimuth(packet, 0), packetUsec(packet));
+    }
+
+    /** rate of the device setting, in RPM */
+    double rpm() const { return rpm_; }
+
+    /** rate of the last window, in RPM, 0 before one was measured */
+    double measuredRpm() const { return measured_; }
+
+    /** packets in a revolution at rpm() */
+    int packetsPerRevolution() const { return packets_; }
+
+    /** rates taken since construction */
+    int changes() const { return changes_; }
+
+private:
+
+    /** timestamps further apart are a gap in the packets */
+    static const int MAX_GAP_USEC = 100000;
+    /** below this the device is not rotating, in RPM */
+    static const int MIN_RPM = 60;
+
+    /** the device setting near @c rpm, or @c rpm to 10 RPM */
+    static double nominalRpm(double rpm)
+    {
+        static const double settings[] = {300.0, 600.0, 1200.0};
+        for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i)
+        {
+            if (fabs(rpm - settings[i]) < settings[i] / 10)
+                return settings[i];
+        }
+        return floor(rpm / 10 + 0.5) * 10;
+    }
+
+    /** whether two packet counts per revolution are within a tenth */
+    static bool samePackets(int a, int b)
+    {
+        return abs(a - b) * 10 <= b;
+    }
+
+    void restart()
+    {
+        windowAzimuth_ = 0;
+        windowUsec_ = 0;
+        windowPackets_ = 0;
+    }
+
+    double rpm_;
+    int packets_;
+    double measured_;
+    int changes_;
+
+    int lastAzimuth_;                    ///< -1 before the first packet
+    uint32_t lastUsec_;
+    int64_t windowAzimuth_;              ///< 1/100 degree turned
+    int64_t windowUsec_;
+    int windowPackets_;
+
+    double candidateRpm_;                ///< rate of the last windows
+    int candidatePackets_;
+    int candidates_;
+};
+
+} // namespace pandar_msgs
+
+#endif // __PANDAR_MSGS_ROTATION_RATE_H
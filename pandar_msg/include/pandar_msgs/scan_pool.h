@@ -0,0 +1,121 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Recycled PandarScan messages for the Pandar40 driver.
+
+*/
+
+#ifndef __PANDAR_MSGS_SCAN_POOL_H
+#define __PANDAR_MSGS_SCAN_POOL_H
+
+#include <vector>
+#include <pandar_msgs/PandarScan.h>
+
+namespace pandar_msgs
+{
+/** @brief Scans reused once every subscriber released them.
+ *
+ *  The pool holds a reference to each of its scans, so a scan is free
+ *  again when it is the only holder: taking it costs no allocation,
+ *  and its packets keep their capacity.  When every scan is in use the
+ *  pool grows, up to max scans, and then hands out scans of its own.
+ *
+ *  Not thread safe: one thread, or one task at a time, takes scans.
+ */
+class ScanPool
+{
+public:
+
+    /** @param size scans allocated up front
+     *  @param max scans held at most
+     *  @param packets packets reserved in each scan
+     */
+    ScanPool(size_t size, size_t max, size_t packets):
+        max_(max), packets_(packets), next_(0), misses_(0)
+    {
+        pool_.reserve(max_);
+        for (size_t i = 0; i < size && i < max_; ++i)
+            add();
+    }
+
+    /** @brief A scan no one else holds.
+     *
+     *  Its packets are left as they were: resizing them within their
+     *  previous size neither allocates nor clears them.
+     */
+    pandar_msgs::PandarScanPtr get()
+    {
+        // round robin, the scan released first is likely free
+        for (size_t i = 0; i < pool_.size(); ++i)
+        {
+            size_t n = (next_ + i) % pool_.size();
+            if (pool_[n].unique())
+            {
+                next_ = n + 1;
+                fit(*pool_[n]);
+                return pool_[n];
+            }
+        }
+        ++misses_;
+        if (pool_.size() < max_)
+        {
+            add();
+            return pool_.back();
+        }
+        pandar_msgs::PandarScanPtr scan(new pandar_msgs::PandarScan);
+        scan->packets.reserve(packets_);
+        return scan;
+    }
+
+    /** @brief Reserve @c packets in scans from now on.
+     *
+     *  Scans taken again are brought to the new size: those reserved
+     *  for more than twice as many packets give the memory back.
+     */
+    void setPackets(size_t packets)
+    {
+        packets_ = packets;
+        for (size_t i = 0; i < pool_.size(); ++i)
+        {
+            if (pool_[i].unique())
+                fit(*pool_[i]);
+        }
+    }
+
+    /** scans allocated because none was free */
+    size_t misses() const { return misses_; }
+
+private:
+
+    /** packets reserved for packets_, within a factor of two */
+    void fit(pandar_msgs::PandarScan &scan)
+    {
+        if (scan.packets.capacity() > 2 * packets_)
+            std::vector<pandar_msgs::PandarPacket>().swap(scan.packets);
+        if (scan.packets.capacity() < packets_)
+            scan.packets.reserve(packets_);
+    }
+
+    void add()
+    {
+        pool_.push_back(pandar_msgs::PandarScanPtr(new pandar_msgs::PandarScan));
+        pool_.back()->packets.reserve(packets_);
+    }
+
+    std::vector<pandar_msgs::PandarScanPtr> pool_;
+    size_t max_;
+    size_t packets_;
+    size_t next_;
+    size_t misses_;
+};
+
+} // namespace pandar_msgs
+
+#endif // __PANDAR_MSGS_SCAN_POOL_H
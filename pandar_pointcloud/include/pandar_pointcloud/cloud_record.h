@@ -0,0 +1,201 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Native recording format of decoded Pandar40 clouds.
+ *
+ *  A recording is a page aligned file header, a sequence of chunks and
+ *  a frame index:
+ *
+ *    record_header_t                   4096 bytes
+ *    chunk 0: record_chunk_t, record_chunk_frame_t[frames],
+ *             points of every frame, padded to 4096
+ *    chunk 1: ...
+ *    record_index_t[frames]            written when the file is closed
+ *
+ *  Points are stored as the PPoint structure itself, so reading an
+ *  uncompressed chunk is a pointer into the mapped file.  Chunks may be
+ *  compressed with zlib instead, and are then inflated one at a time.
+ *
+ *  The index gives the chunk and the offset of every frame, so seeking
+ *  to a frame is a lookup.  A recording that was not closed has no
+ *  index; the reader rebuilds it from the chunk headers.
+ */
+
+#ifndef __PANDAR_CLOUD_RECORD_H
+#define __PANDAR_CLOUD_RECORD_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <pandar_pointcloud/rawdata.h>
+
+namespace pandar_pointcloud
+{
+static const uint32_t RECORD_MAGIC = 0x43524450;         // "PDRC"
+static const uint32_t RECORD_CHUNK_MAGIC = 0x4b484350;   // "PCHK"
+static const uint32_t RECORD_VERSION = 1;
+static const size_t RECORD_ALIGN = 4096;
+
+enum RecordCompression { RECORD_NONE = 0, RECORD_ZLIB = 1 };
+
+/** \brief File header, rewritten when the recording is closed. */
+typedef struct record_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t point_size;                 ///< sizeof(PPoint) of the writer
+    uint32_t reserved;
+    uint64_t frames;                     ///< 0 until closed
+    uint64_t index_offset;               ///< 0 until closed
+    char frame_id[64];
+} record_header_t;
+
+/** \brief Chunk header, followed by its frame table. */
+typedef struct record_chunk {
+    uint32_t magic;
+    uint32_t frames;
+    uint32_t compression;                ///< RecordCompression
+    uint32_t reserved;
+    uint64_t raw_size;                   ///< bytes of points
+    uint64_t stored_size;                ///< bytes of points in the file
+    uint64_t next_offset;                ///< file offset of the next chunk
+} record_chunk_t;
+
+typedef struct record_chunk_frame {
+    uint64_t stamp;                      ///< pcl stamp, microseconds
+    uint32_t points;
+    uint32_t reserved;
+} record_chunk_frame_t;
+
+/** \brief Index entry of a frame. */
+typedef struct record_index {
+    uint64_t stamp;                      ///< pcl stamp, microseconds
+    uint64_t chunk_offset;               ///< file offset of its chunk
+    uint64_t point_offset;               ///< byte offset in the chunk points
+    uint32_t points;
+    uint32_t reserved;
+} record_index_t;
+
+/** \brief Writes decoded clouds into a recording. */
+class CloudRecordWriter
+{
+public:
+
+    CloudRecordWriter();
+    ~CloudRecordWriter();
+
+    /** \brief Create the recording, replacing any file there.
+     *
+     *  @param path file to write
+     *  @param chunk_frames frames in each chunk
+     *  @param compression zlib level 1-9, 0 stores points as they are
+     *  @returns 0 if successful, errno value for failure
+     */
+    int open(const std::string &path, int chunk_frames, int compression);
+
+    /** \brief Append a frame.
+     *  @returns 0 if successful, errno value for failure
+     */
+    int write(const pandar_rawdata::PPointCloud &pc);
+
+    /** \brief Flush the last chunk and write the index.
+     *  @returns 0 if successful, errno value for failure
+     */
+    int close();
+
+    bool isOpen() const { return fd_ >= 0; }
+    uint64_t frames() const { return index_.size(); }
+
+private:
+
+    int writeHeader(uint64_t index_offset);
+    int flushChunk();
+
+    int fd_;
+    int chunk_frames_;
+    int compression_;
+    uint64_t offset_;                    ///< where the next chunk goes
+    std::string frame_id_;
+
+    std::vector<record_chunk_frame_t> chunk_table_;
+    std::vector<uint8_t> chunk_points_;
+    std::vector<uint8_t> buffer_;
+    std::vector<record_index_t> index_;
+};
+
+/** \brief Maps a recording and reads its frames by number.
+ *
+ *    CloudRecordReader reader;
+ *    reader.open("run.pcr");
+ *    for (size_t i = 0; i < reader.frames(); ++i)
+ *    {
+ *        uint32_t n;
+ *        const pandar_rawdata::PPoint *p = reader.points(i, n);
+ *        ...
+ *    }
+ */
+class CloudRecordReader
+{
+public:
+
+    CloudRecordReader();
+    ~CloudRecordReader();
+
+    /** \brief Map a recording, rebuilding the index if it was not
+     *  closed.
+     *  @returns 0 if successful, errno value for failure
+     */
+    int open(const std::string &path);
+    void close();
+
+    size_t frames() const { return index_.size(); }
+    const record_index_t &frame(size_t n) const { return index_[n]; }
+    const std::string &frameId() const { return frame_id_; }
+
+    /** \brief Points of frame @c n, without copying them out of the
+     *  mapping if its chunk is not compressed.
+     *
+     *  The pointer stays valid until a frame of another compressed
+     *  chunk is read, or the reader is closed.
+     *
+     *  @param count set to the number of points
+     *  @returns NULL if the frame can not be read
+     */
+    const pandar_rawdata::PPoint *points(size_t n, uint32_t &count);
+
+    /** \brief Copy frame @c n into a cloud.
+     *  @returns false if the frame can not be read
+     */
+    bool read(size_t n, pandar_rawdata::PPointCloud &pc);
+
+    /** \brief First frame stamped at or after @c stamp, frames() if
+     *  none is.
+     */
+    size_t seek(uint64_t stamp) const;
+
+private:
+
+    bool rebuildIndex();
+    const uint8_t *chunkPoints(uint64_t chunk_offset);
+
+    const uint8_t *base_;
+    size_t size_;
+    std::string frame_id_;
+    std::vector<record_index_t> index_;
+
+    // the compressed chunk inflated last
+    uint64_t cached_chunk_;
+    std::vector<uint8_t> cache_;
+};
+
+} // namespace pandar_pointcloud
+
+#endif // __PANDAR_CLOUD_RECORD_H
@@ -0,0 +1,121 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Edge and planar feature points of a Pandar40 frame, picked
+ *  while it is decoded.
+ */
+
+#ifndef __PANDAR_FEATURES_H
+#define __PANDAR_FEATURES_H
+
+#include <utility>
+#include <vector>
+#include <pcl_ros/point_cloud.h>
+#include <pandar_pointcloud/point_types.h>
+
+namespace pandar_rawdata
+{
+/** \brief Feature selection settings. */
+typedef struct feature_config {
+    int sectors;                         ///< sectors of a turn, per ring
+    int edges;                           ///< edge points per sector at most
+    int planars;                         ///< planar points per sector at most
+    double edge_threshold;               ///< smoothness above: an edge
+    double planar_threshold;             ///< smoothness below: planar
+} feature_config_t;
+
+/** \brief Picks edge and planar points along each ring, LOAM style.
+ *
+ *  The points of a ring come in firing order, so the smoothness of a
+ *  point is known once WINDOW / 2 more points of its ring came:
+ *
+ *    c = |sum over the window of (X_j - X_i)|^2
+ *
+ *  in square meters, unnormalized as in A-LOAM, whose thresholds of
+ *  0.1 apply.
+ *
+ *  Points are collected per ring until the ring enters the next
+ *  sector.  Then the sector gets its sharpest points as edges and its
+ *  smoothest as planar, skipping the neighbours of points already
+ *  picked.  A gap in the ring restarts its window.
+ *
+ *  Memory is reused from frame to frame.  Not thread safe.
+ */
+class FeatureExtractor
+{
+public:
+
+    typedef pandar_pointcloud::PointXYZIT Point;
+    typedef pcl::PointCloud<Point> Cloud;
+
+    /** points in the smoothness window, odd */
+    static const int WINDOW = 11;
+    /** azimuth gap restarting a window, 1/100 degree */
+    static const int MAX_GAP = 100;
+    static const int MAX_RINGS = 64;
+
+    explicit FeatureExtractor(const feature_config_t &config);
+
+    /** \brief Add the next point of its ring.
+     *  @param azimuth of its block, 1/100 degree
+     */
+    void add(const Point &point, int azimuth);
+
+    /** \brief Pick the features of the sectors still open, and start
+     *  the next frame.  The points given to add() afterwards go to
+     *  new clouds.
+     */
+    void endFrame();
+
+    /** \brief Features of the frame ended by the last endFrame().
+     *
+     *  The clouds are handed over: the next frame is picked into new
+     *  ones of the same capacity.
+     */
+    Cloud::Ptr takeEdges();
+    Cloud::Ptr takePlanars();
+
+private:
+
+    typedef struct {
+        Point point;
+        float smoothness;
+        int sequence;                    ///< position along the ring
+        bool picked;
+    } Candidate;
+
+    typedef struct {
+        Point window[WINDOW];            ///< last points, circular
+        int next;                        ///< where the next one goes
+        int count;                       ///< points in the window
+        int lastAzimuth;
+        int windowAzimuth[WINDOW];
+        double sum[3];                   ///< of the window coordinates
+        int sequence;                    ///< points added
+        int sector;                      ///< of the candidates, -1 none
+        std::vector<Candidate> candidates;
+    } Ring;
+
+    void flushSector(Ring &ring);
+    void pick(std::vector<Candidate> &candidates, bool edges);
+
+    feature_config_t config_;
+    Ring rings_[MAX_RINGS];
+    std::vector<std::pair<float, int> > order_;  ///< candidates being picked
+    Cloud::Ptr edges_;                   ///< of the frame being decoded
+    Cloud::Ptr planars_;
+    Cloud::Ptr doneEdges_;               ///< of the frame ended
+    Cloud::Ptr donePlanars_;
+};
+
+} // namespace pandar_rawdata
+
+#endif // __PANDAR_FEATURES_H
@@ -66,10 +66,29 @@ namespace pandar_pointcloud
     virtual int getPacket(pandar_msgs::PandarPacket *pkt,
                           const double time_offset) = 0;
 
+    /** @brief Wall clock time at which the last packet returned by
+     *  getPacket() was received, in seconds.
+     *
+     *  For live input this is the kernel receive time, so it also
+     *  covers the time the packet spent in the socket buffer.
+     */
+    double receiveTime() const { return receive_time_; }
+
+    /** @brief File descriptor to watch for packets, -1 if there is
+     *  none to watch and getPacket() has to be called in a loop.
+     */
+    virtual int fd() const { return -1; }
+
+    /** @brief How long getPacket() waits for a packet, in msec; with
+     *  0 it returns 1 at once when none is there.
+     */
+    virtual void setPollTimeout(int msec) {}
+
   protected:
     ros::NodeHandle private_nh_;
     uint16_t port_;
     std::string devip_str_;
+    double receive_time_;
   };
 
   /** @brief Live pandar input from socket. */
@@ -83,11 +102,14 @@ namespace pandar_pointcloud
     virtual int getPacket(pandar_msgs::PandarPacket *pkt, 
                           const double time_offset);
     void setDeviceIP( const std::string& ip );
+    virtual int fd() const { return sockfd_; }
+    virtual void setPollTimeout(int msec) { poll_timeout_ = msec; }
   private:
 
   private:
     int sockfd_;
     in_addr devip_;
+    int poll_timeout_;
   };
 
 
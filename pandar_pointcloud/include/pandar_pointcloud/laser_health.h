@@ -0,0 +1,102 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Per laser channel statistics of the Pandar40, accumulated
+ *  while decoding.
+ */
+
+#ifndef __PANDAR_LASER_HEALTH_H
+#define __PANDAR_LASER_HEALTH_H
+
+#include <stdint.h>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace pandar_rawdata
+{
+/** \brief Statistics of one laser over the sliding window. */
+typedef struct laser_stats {
+    enum Status { OK = 0, DEGRADED = 1, DEAD = 2 };
+
+    double returns_per_frame;
+    double mean_range;                   ///< meters, over the returns
+    double mean_intensity;               ///< over the returns
+    double zero_ratio;                   ///< firings without a return
+    int status;
+} laser_stats_t;
+
+/** \brief Per laser return statistics over the last few frames.
+ *
+ *  add() is called for every return of every firing by the decoding
+ *  thread, so twice per firing in dual return mode, and only bumps a
+ *  few counters; endFrame() slides the window and computes the
+ *  statistics, which other threads read with snapshot().
+ *
+ *  A laser is dead when it returned nothing over the whole window.  It
+ *  is degraded when it misses far more often, or sees far dimmer
+ *  returns, than the median laser: a scene affects all lasers alike,
+ *  a failing channel does not.
+ */
+class LaserHealth
+{
+public:
+
+    static const int LASERS = 40;
+
+    LaserHealth(int window_frames = 10);
+
+    void add(int laser, uint32_t range, uint16_t reflectivity)
+    {
+        counts_t &c = current_[laser];
+        ++c.firings;
+        if (range == 0)
+        {
+            ++c.zeros;
+            return;
+        }
+        c.range_sum += range;
+        c.intensity_sum += reflectivity >> 8;
+    }
+
+    /** \brief Close the current frame and update the statistics. */
+    void endFrame();
+
+    /** \brief Copy the statistics of every laser.
+     *  @returns the number of frames in the window
+     */
+    int snapshot(laser_stats_t stats[LASERS]) const;
+
+private:
+
+    typedef struct counts {
+        uint64_t firings;
+        uint64_t zeros;
+        uint64_t range_sum;
+        uint64_t intensity_sum;
+    } counts_t;
+
+    counts_t current_[LASERS];
+    counts_t totals_[LASERS];
+    std::vector<counts_t> history_;       ///< window_frames * LASERS
+    int window_;
+    int head_;
+    int frames_;
+    std::vector<double> zero_ratios_;     ///< scratch of endFrame()
+    std::vector<double> intensities_;
+
+    mutable boost::mutex lock_;
+    laser_stats_t stats_[LASERS];
+    int stats_frames_;
+};
+
+} // namespace pandar_rawdata
+
+#endif // __PANDAR_LASER_HEALTH_H
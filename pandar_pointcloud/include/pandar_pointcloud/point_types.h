@@ -40,6 +40,7 @@ struct PointXYZIT {
     uint8_t intensity;
     double timestamp;
     uint16_t ring;                      ///< laser ring number
+    uint8_t return_index;               ///< 0 single return, 1-2 dual return
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW // make sure our new allocators are aligned
 } EIGEN_ALIGN16;
 // enforce SSE padding for correct memory alignment
@@ -83,7 +84,8 @@ POINT_CLOUD_REGISTER_POINT_STRUCT(pandar_pointcloud::PointXYZIR,
 
 POINT_CLOUD_REGISTER_POINT_STRUCT(pandar_pointcloud::PointXYZIT,
                                   (float, x, x)(float, y, y)(float, z, z)
-                                  (uint8_t, intensity, intensity)(double, timestamp, timestamp)(uint16_t, ring, ring))
+                                  (uint8_t, intensity, intensity)(double, timestamp, timestamp)(uint16_t, ring, ring)
+                                  (uint8_t, return_index, return_index))
 
 POINT_CLOUD_REGISTER_POINT_STRUCT(pandar_pointcloud::PointXYZITd,
                                   (double, x, x)(double, y, y)(double, z, z)(uint8_t, intensity, intensity)(double, timestamp,
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/format.hpp>
 #include <math.h>
 
@@ -32,8 +33,12 @@
 #include <pcl_ros/point_cloud.h>
 #include <pandar_msgs/PandarScan.h>
 #include <pandar_msgs/PandarGps.h>
+#include <pandar_msgs/rotation_rate.h>
 #include <pandar_pointcloud/point_types.h>
 #include <pandar_pointcloud/calibration.h>
+#include <pandar_pointcloud/laser_health.h>
+#include <pandar_pointcloud/time_base.h>
+#include <pandar_pointcloud/features.h>
 
 namespace pandar_rawdata
 {
@@ -81,20 +86,98 @@ typedef struct raw_packet
     uint32_t timestamp;
     uint8_t factory[2];
     double recv_time;
+    bool dual;                           ///< blocks are pairs of returns
 } raw_packet_t;
 
+/** \brief Return mode byte, the first of the factory bytes. */
+static const uint8_t RETURN_MODE_STRONGEST = 0x37;
+static const uint8_t RETURN_MODE_LAST = 0x38;
+static const uint8_t RETURN_MODE_DUAL = 0x39;
+
+/** \brief Points kept from a dual return firing.
+ *
+ *  In dual return mode each firing takes a pair of blocks with the
+ *  same azimuth, one per return.
+ */
+enum DualReturnPolicy {
+    DUAL_BOTH,                           ///< both, told apart by return_index
+    DUAL_DEDUPE,                         ///< both, unless they are the same
+    DUAL_STRONGEST,                      ///< the brighter one
+    DUAL_LAST                            ///< the farther one
+};
+
+/** \brief Points of a frame kept for an additional output.
+ *
+ *  Outputs are filled in the pass that fills the main cloud, from the
+ *  same decoded points, so decoding costs the same whatever their
+ *  number.  Azimuths are those of the blocks, in the device frame
+ *  like the start angle.
+ */
+typedef struct output_filter {
+    uint64_t rings;                      ///< bit per laser kept
+    int min_azimuth;                     ///< 1/100 degree, all if equal to
+    int max_azimuth;                     ///< max_azimuth, may wrap past 0
+    double min_range;                    ///< meters
+    double max_range;                    ///< meters
+    int decimation;                      ///< one firing out of decimation
+} output_filter_t;
+
+/** \brief Rings reduced to a planar scan while decoding.
+ *
+ *  Each bin of the scan keeps the nearest point of the rings, by its
+ *  distance in the x-y plane.  Bins cover a turn counterclockwise
+ *  from the -x axis, at -pi, like a LaserScan in the cloud frame.
+ */
+typedef struct scan_band {
+    uint64_t rings;                      ///< bit per laser, 0 for no scan
+    int bins;                            ///< bins in a turn
+    double min_range;                    ///< meters, in the x-y plane
+    double max_range;                    ///< meters, in the x-y plane
+} scan_band_t;
+
 typedef struct gps_struct{
     int used;
     time_t gps;
 }gps_struct_t;
 
+static const int GPS_PACKET_SIZE = 512;
+
+/** \brief Completeness of the last frame unpacked. */
+typedef struct frame_info {
+    int blocks;                          ///< blocks in the frame
+    int expected_blocks;                 ///< blocks in a full revolution
+    int missing_blocks;                  ///< lost in gaps inside the frame
+    int reordered_blocks;                ///< arrived out of order
+    int azimuth_step;                    ///< 1/100 degree between blocks
+    double coverage;                     ///< blocks / expected, at most 1
+    double rpm;                          ///< rotation rate setting measured
+} frame_info_t;
+
+/** \brief Parse a GPS packet.
+ *
+ *  @param gps message to fill in, its stamp is left alone
+ *  @param buf packet contents
+ *  @param len packet size
+ *  @returns 0 if successful;
+ *           -1 if this is not a GPS packet
+ */
+int parseGpsPacket(pandar_msgs::PandarGps &gps, const uint8_t *buf, int len);
+
+/** \brief Schedule the second reported by a GPS message.
+ *
+ *  The message arrives after the PPS it describes, so its second
+ *  plus one is handed to unpack() through @c gps2, to be used once
+ *  the packet timestamps restart.
+ */
+void updateGps(const pandar_msgs::PandarGps &gps, gps_struct_t &gps2);
+
 /** \brief Pandar40 data conversion class */
 class RawData
 {
 public:
 
     RawData();
-    ~RawData() {}
+    ~RawData() { delete[] bufferPacket; }
 
     /** \brief Set up for data processing.
      *
@@ -123,8 +206,9 @@ public:
     int setupOffline(std::string calibration_file, double max_range_, double min_range_);
 
     void unpack(const pandar_msgs::PandarPacket &pkt, PPointCloud &pc);
-    int unpack(const pandar_msgs::PandarScan::ConstPtr &scanMsg, PPointCloud &pc, time_t& gps1 , 
-                                            gps_struct_t &gps2 , double& firstStamp, int& lidarRotationStartAngle);
+    int unpack(const pandar_msgs::PandarScan &scan, size_t &next, PPointCloud &pc,
+               time_t& gps1 , gps_struct_t &gps2 , double& firstStamp,
+               int lidarRotationStartAngle);
 
     int unpack(pandar_msgs::PandarPacket &packet, PPointCloud &pc, time_t& gps1 , 
                                             gps_struct_t &gps2 , double& firstStamp, int& lidarRotationStartAngle);
@@ -132,8 +216,83 @@ public:
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
 
+    void setDualReturnPolicy(DualReturnPolicy policy) { dualPolicy_ = policy; }
+
+    /** \brief Fill an additional cloud for each filter, at most 64,
+     *  along with the one passed to unpack().
+     */
+    void setOutputs(const std::vector<output_filter_t> &filters);
+
+    size_t outputs() const { return outputs_.size(); }
+
+    /** \brief The points of the frame assembled by the last unpack()
+     *  call that returned 1, for output @c output; the next frame is
+     *  filled in a new cloud of the same capacity.
+     */
+    PPointCloud::Ptr takeOutput(size_t output);
+
+    /** \brief Fill a planar scan from the rings of @c band, along with
+     *  the cloud passed to unpack().
+     */
+    void setScanBand(const scan_band_t &band);
+
+    /** \brief Copy out the ranges and intensities of the frame
+     *  assembled by the last unpack() call that returned 1, infinity
+     *  and 0 where a bin has no point.  Bin i covers the angles from
+     *  -pi + i * 2 pi / bins on, counterclockwise.
+     */
+    void takeScan(std::vector<float> &ranges, std::vector<float> &intensities);
+
+    /** \brief Pick edge and planar points along each ring while
+     *  decoding; the features of a frame are taken from features()
+     *  after the unpack() call that returned 1.
+     */
+    void setFeatures(const feature_config_t &config);
+
+    /** \brief The feature extractor, NULL unless setFeatures() was called. */
+    FeatureExtractor *features() { return features_.get(); }
+
+    /** \brief Forget the frame being assembled.
+     *
+     *  Used when packets of it were dropped: the packets up to the next
+     *  frame boundary are discarded too, so the next frame unpacked is
+     *  a whole one.
+     */
+    void reset();
+
+    /** \brief Completeness of the frame returned by the last unpack()
+     *  call that returned 1.
+     */
+    const frame_info_t &frameInfo() const { return frameInfo_; }
+
+    /** \brief Per laser statistics, updated with every frame unpacked. */
+    const LaserHealth &laserHealth() const { return health_; }
+
+    /** \brief Rotation rate measured from the packets unpacked.
+     *
+     *  The frame buffer follows its packets per revolution, and so may
+     *  the users of frameInfo().
+     */
+    const pandar_msgs::RotationRate &rotationRate() const { return rotation_; }
+
+    /** \brief Measure the rotation rate from a packet that is not
+     *  decoded, so that it is known while no one listens.
+     *
+     *  @returns true when the rate measured changed
+     */
+    bool measureRotation(const pandar_msgs::PandarPacket &packet);
+
+    /** \brief Take the second of each packet from a time base shared
+     *  with other sensors, rather than from gps1 and gps2, once it has
+     *  a GPS time.  NULL goes back to gps1 and gps2.
+     */
+    void setTimeBase(TimeBase *timeBase) { timeBase_ = timeBase; }
+
 private:
 
+    /** gives the micro benchmarks in src/tools access to the decode stages */
+    friend class RawDataBenchmark;
+
     /** configuration parameters */
     typedef struct {
         std::string calibrationFile;     ///< calibration file name
@@ -164,21 +323,72 @@ private:
 	int parseRawData(raw_packet* packet, const uint8_t* buf, const int len);
 	void toPointClouds (raw_packet* packet, PPointCloud& pc);
     void toPointClouds (raw_packet_t* packet,int laser ,  PPointCloud& pc , double stamp , double& firstStamp);
+    void toPointCloudsDual(raw_packet_t* packet, int block, PPointCloud& pc,
+                           double stamp, double& firstStamp);
     void toPointClouds (raw_packet_t* packet,int laser , int block,  PPointCloud& pc);
 	void computeXYZIR(PPoint& point, int azimuth,
 			const raw_measure_t& laserReturn,
 			const pandar_pointcloud::PandarLaserCorrection& correction);
 
+    int addPacket(const pandar_msgs::PandarPacket &packet, PPointCloud &pc,
+                  time_t& gps1, gps_struct_t &gps2, double& firstStamp,
+                  int lidarRotationStartAngle);
+    void selectOutputs(int azimuth, int firing);
+    void addToOutputs(const PPoint &point, uint32_t range);
+    void addToScan(const PPoint &point);
+    void reserveBuffer(int count);
+    void resizeBuffer();
+    void updateAzimuthStep(const raw_packet_t &packet);
+    int findFrameEnd(int lidarRotationStartAngle,
+                     int &currentPacketEnd, int &currentBlockEnd);
+    void discardPartialFrame(int currentPacketEnd, int currentBlockEnd);
+    void assembleFrame(PPointCloud &pc, time_t& gps1, gps_struct_t &gps2,
+                       double& firstStamp, int currentPacketEnd,
+                       int currentBlockEnd);
+
+    /** packets kept while looking for the end of a frame: this many
+        revolutions, plus BUFFER_MARGIN packets */
+    static const int BUFFER_REVOLUTIONS = 3;
+    static const int BUFFER_MARGIN = 100;
+
     int lastBlockEnd;
 
     raw_packet_t *bufferPacket;
     int bufferPacketSize;
+    int bufferCapacity;
 
     int currentPacketStart;
 
     int lastTimestamp;
 
     int lastAzumith;
+
+    LaserHealth health_;
+    TimeBase *timeBase_;
+    DualReturnPolicy dualPolicy_;
+    pandar_msgs::RotationRate rotation_;
+
+    /** additional outputs, and those keeping the firing converted,
+        one bit per output */
+    typedef struct {
+        output_filter_t filter;
+        PPointCloud::Ptr cloud;
+    } Output;
+    std::vector<Output> outputs_;
+    uint64_t firingOutputs_;
+
+    /** planar scan of the frame being assembled, allocated for
+        scanBand_.bins by setScanBand() */
+    scan_band_t scanBand_;
+    std::vector<float> scanRanges_;
+    std::vector<float> scanIntensities_;
+
+    /** edge and planar points, fed every point in firing order */
+    boost::shared_ptr<FeatureExtractor> features_;
+
+    int azimuthStep;
+    frame_info_t frameInfo_;
+    bool discardFrame;
 };
 
 } // namespace pandar_rawdata
@@ -0,0 +1,178 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Shared memory transport of Pandar40 point clouds between
+ *  processes of the same host.
+ *
+ *  The cloud nodelet writes every frame into a POSIX shared memory
+ *  ring of preallocated slots, and announces it with a small
+ *  pandar_msgs/PandarShmFrame descriptor.  Readers map the ring read
+ *  only and copy frames out with a single memcpy, instead of
+ *  deserializing a PointCloud2 received over TCPROS.
+ *
+ *  Each slot is guarded by a sequence lock: its lock word is odd while
+ *  the writer fills it, so a reader that raced with the writer sees
+ *  the word change and retries.  Readers wait for new frames on a
+ *  futex in the ring header, which the writer bumps after every frame.
+ *
+ *  Processes in separate containers must share /dev/shm (for Docker,
+ *  --ipc=host or a common --ipc=container:...).
+ */
+
+#ifndef __PANDAR_SHM_RING_H
+#define __PANDAR_SHM_RING_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <pandar_pointcloud/rawdata.h>
+
+namespace pandar_pointcloud
+{
+static const uint32_t SHM_RING_MAGIC = 0x50445352;   // "PDSR"
+static const uint32_t SHM_RING_VERSION = 1;
+
+/** \brief Ring header, at the start of the segment. */
+typedef struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t max_points;
+    uint32_t point_size;                 ///< sizeof(PPoint) of the writer
+    uint32_t futex;                      ///< bumped after every frame
+    uint64_t slot_stride;                ///< bytes from slot to slot
+    uint64_t sequence;                   ///< last frame written, from 1
+} shm_ring_header_t;
+
+/** \brief Slot header, followed by max_points points. */
+typedef struct shm_slot_header {
+    uint64_t lock;                       ///< odd while being written
+    uint64_t sequence;
+    uint64_t stamp;                      ///< pcl stamp, microseconds
+    uint32_t points;
+    uint32_t reserved;
+    char frame_id[64];
+} shm_slot_header_t;
+
+/** \brief Writes frames into a shared memory ring. */
+class ShmRingWriter
+{
+public:
+
+    ShmRingWriter();
+    ~ShmRingWriter();
+
+    /** \brief Create the segment, replacing any previous one.
+     *
+     *  @param name POSIX shm name, such as "/pandar_points"
+     *  @param slots frames kept in the ring
+     *  @param max_points capacity of each slot
+     *  @returns 0 if successful, errno value for failure
+     */
+    int open(const std::string &name, uint32_t slots, uint32_t max_points);
+
+    /** \brief Unmap and remove the segment, if open. */
+    void close();
+
+    /** \brief Copy a frame into the next slot and wake the readers.
+     *
+     *  @param slot set to the slot written
+     *  @returns the frame sequence number, 0 if the frame does not fit
+     */
+    uint64_t write(const pandar_rawdata::PPointCloud &pc, uint32_t &slot);
+
+    const std::string &name() const { return name_; }
+
+private:
+
+    std::string name_;
+    uint8_t *base_;
+    size_t size_;
+    uint64_t sequence_;
+};
+
+/** \brief Reads frames from a shared memory ring. */
+class ShmRingReader
+{
+public:
+
+    ShmRingReader();
+    ~ShmRingReader();
+
+    /** \brief Map an existing segment, read only.
+     *  @returns 0 if successful, errno value for failure
+     */
+    int open(const std::string &name);
+    void close();
+    bool isOpen() const { return base_ != NULL; }
+
+    /** \brief Copy the newest frame, waiting for one newer than the
+     *  last read.
+     *
+     *  @param pc replaced with the frame
+     *  @param timeout seconds to wait
+     *  @param sequence set to the frame sequence number
+     *  @returns 0 if successful;
+     *           ETIMEDOUT if no new frame came;
+     *           EAGAIN if the writer kept overwriting the slot
+     */
+    int read(pandar_rawdata::PPointCloud &pc, double timeout,
+             uint64_t *sequence = NULL);
+
+    /** \brief Frames the writer produced that this reader never read. */
+    uint64_t missed() const { return missed_; }
+
+private:
+
+    const uint8_t *base_;
+    size_t size_;
+    uint64_t last_sequence_;
+    uint64_t missed_;
+};
+
+/** \brief Reads frames on its own thread and hands them to a callback.
+ *
+ *  For consumers outside the nodelet manager:
+ *
+ *    ShmCloudSubscriber sub("/pandar_points", &onCloud);
+ *
+ *  The segment is reopened whenever frames stop for a few seconds, so
+ *  a restarted cloud nodelet is picked up again.
+ */
+class ShmCloudSubscriber
+{
+public:
+
+    typedef boost::function<void(const pandar_rawdata::PPointCloud::ConstPtr &)>
+        Callback;
+
+    ShmCloudSubscriber(const std::string &name, const Callback &callback);
+    ~ShmCloudSubscriber();
+
+    uint64_t missed() const { return missed_; }
+
+private:
+
+    void run();
+
+    std::string name_;
+    Callback callback_;
+    boost::atomic<bool> running_;
+    boost::atomic<uint64_t> missed_;
+    boost::thread thread_;
+};
+
+} // namespace pandar_pointcloud
+
+#endif // __PANDAR_SHM_RING_H
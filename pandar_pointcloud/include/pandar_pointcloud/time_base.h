@@ -0,0 +1,94 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief GPS time shared by every Pandar40 of a process.
+ */
+
+#ifndef __PANDAR_TIME_BASE_H
+#define __PANDAR_TIME_BASE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <boost/thread/mutex.hpp>
+
+namespace pandar_rawdata
+{
+/** \brief Statistics of the time base, for diagnostics. */
+typedef struct time_base_stats {
+    bool locked;                         ///< a GPS time was accepted
+    double offset;                       ///< UTC minus packet stamps, seconds
+    uint64_t accepted;                   ///< GPS times fused
+    uint64_t outliers;                   ///< GPS times rejected
+    uint64_t relocks;                    ///< offset jumps accepted
+} time_base_stats_t;
+
+/** \brief Decides the UTC second of packets for all sensors at once.
+ *
+ *  Each Pandar40 stamps its packets with the microseconds since the
+ *  last PPS pulse, and sends the UTC time once a second in a GPS
+ *  packet.  Sensors sharing a PPS source share the pulse, so the UTC
+ *  second of a pulse is the same for all of them: the pulse is found
+ *  from the stamp of a packet minus its microseconds, and the offset
+ *  between such pulse stamps and UTC is what every GPS packet of every
+ *  sensor measures.
+ *
+ *  The offset is a whole number of seconds plus the receive latency.
+ *  A GPS time more than half a second away from it is an outlier, and
+ *  is ignored unless RELOCK_SAMPLES in a row agree on a new offset, as
+ *  after a jump of the system clock.  The second of a packet is then
+ *  its pulse stamp plus the offset, rounded: sensors decide each
+ *  rollover alike, whatever the order their GPS packets came in.
+ */
+class TimeBase
+{
+public:
+
+    /** GPS times agreeing before the first offset is used */
+    static const int LOCK_SAMPLES = 2;
+    /** outliers agreeing before the offset is replaced */
+    static const int RELOCK_SAMPLES = 3;
+
+    /** \brief The time base of this process. */
+    static TimeBase &instance();
+
+    /** \brief Fuse the time of a GPS packet.
+     *
+     *  @param second UTC second starting at the pulse, as updateGps()
+     *         computes it
+     *  @param pulse stamp of that pulse, from the last data packet of
+     *         the same sensor
+     *  @returns false if rejected as an outlier
+     */
+    bool addGps(time_t second, double pulse);
+
+    /** \brief UTC second of a data packet.
+     *
+     *  @param usec microseconds since the pulse, from the packet
+     *  @param stamp receive stamp of the packet
+     *  @returns -1 until a GPS time was accepted
+     */
+    time_t second(uint32_t usec, double stamp);
+
+    time_base_stats_t stats();
+
+private:
+
+    TimeBase();
+
+    boost::mutex mutex_;
+    time_base_stats_t stats_;
+    double candidate_;                   ///< offset of the last outliers
+    int candidates_;
+};
+
+} // namespace pandar_rawdata
+
+#endif // __PANDAR_TIME_BASE_H
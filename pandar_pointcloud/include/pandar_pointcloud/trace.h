@@ -0,0 +1,54 @@
+/* -*- mode: C++ -*-
+ *
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Static tracepoints in the Pandar40 receive, decode and
+ *  publish path.
+ *
+ *  When <sys/sdt.h> is available (systemtap-sdt-dev) the probes are
+ *  USDT probes of provider "pandar": each one is a single NOP until a
+ *  tracer attaches to it, for example
+ *
+ *    bpftrace -e 'usdt:./cloud_node:pandar:publish { @[arg0] = count(); }'
+ *    perf probe -x cloud_node sdt_pandar:frame_boundary
+ *
+ *  Otherwise the macros expand to nothing.  Probe arguments are still
+ *  evaluated when tracing is off, so only pass values that are already
+ *  at hand.  Times are wall clock nanoseconds.
+ *
+ *  Probes:
+ *
+ *    packet_receive(bytes, receive_ns)     input returned a packet
+ *    enqueue(queue_depth, enqueue_ns)      packet handed to the converter
+ *    dequeue(queue_depth, queue_wait_ns)   converter took a packet
+ *    frame_boundary(packets, block)        a revolution was closed
+ *    convert_start(packets)                frame conversion begins
+ *    convert_end(points)                   frame conversion done
+ *    publish(points, stamp_ns)             frame published
+ */
+
+#ifndef __PANDAR_POINTCLOUD_TRACE_H
+#define __PANDAR_POINTCLOUD_TRACE_H
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PANDAR_TRACE1(name, a) DTRACE_PROBE1(pandar, name, a)
+#define PANDAR_TRACE2(name, a, b) DTRACE_PROBE2(pandar, name, a, b)
+
+#else
+
+#define PANDAR_TRACE1(name, a) do {} while (0)
+#define PANDAR_TRACE2(name, a, b) do {} while (0)
+
+#endif // HAVE_SYS_SDT_H
+
+#endif // __PANDAR_POINTCLOUD_TRACE_H
@@ -0,0 +1,236 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Bounded queue between two stages of the Pandar40 cloud pipeline.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_BOUNDED_QUEUE_H_
+#define _PANDAR_POINTCLOUD_BOUNDED_QUEUE_H_ 1
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace pandar_pointcloud
+{
+/** @brief Bounded queue over a ring allocated up front, and again
+ *  only when resize() changes its capacity.
+ *
+ *  What happens when the producer finds it full is up to the policy:
+ *
+ *    DROP_OLDEST -- the oldest entry makes room for the new one
+ *    DROP_ALL    -- every queued entry is discarded
+ *    BLOCK       -- the producer waits for the consumer
+ *
+ *  The memory used is capacity entries, and with the drop policies the
+ *  time an entry can wait is bounded by capacity entries of work.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+
+    enum Policy { DROP_OLDEST, DROP_ALL, BLOCK };
+
+    BoundedQueue(size_t capacity, Policy policy):
+        ring_(capacity > 0 ? capacity : 1), head_(0), size_(0),
+        policy_(policy), stopped_(false), dropped_(0)
+    {}
+
+    /** @brief Append an entry.
+     *  @returns the number of entries dropped to make room for it
+     */
+    size_t push(const T &item)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        size_t dropped = 0;
+        if (size_ == ring_.size())
+        {
+            switch (policy_)
+            {
+            case BLOCK:
+                while (size_ == ring_.size() && !stopped_)
+                    not_full_.wait(lock);
+                if (stopped_)
+                    return 0;
+                break;
+            case DROP_OLDEST:
+                head_ = (head_ + 1) % ring_.size();
+                --size_;
+                dropped = 1;
+                break;
+            case DROP_ALL:
+                dropped = size_;
+                clear();
+                break;
+            }
+        }
+        ring_[(head_ + size_) % ring_.size()] = item;
+        ++size_;
+        dropped_ += dropped;
+        not_empty_.notify_one();
+        return dropped;
+    }
+
+    /** @brief Take the oldest entry, waiting up to @c timeout for one.
+     *
+     *  @param depth set to the entries left behind
+     *  @returns false on timeout or once stopped
+     */
+    bool pop(T &item, size_t &depth,
+             const boost::posix_time::time_duration &timeout)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (size_ == 0 && !stopped_)
+        {
+            if (!not_empty_.timed_wait(lock, timeout))
+                return false;
+        }
+        if (size_ == 0)
+            return false;
+        take(item);
+        --size_;
+        depth = size_;
+        not_full_.notify_one();
+        return true;
+    }
+
+    /** @brief Take the oldest entry if there is one, without waiting.
+     *  @param depth set to the entries left behind
+     */
+    bool tryPop(T &item, size_t &depth)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (size_ == 0)
+            return false;
+        take(item);
+        --size_;
+        depth = size_;
+        not_full_.notify_one();
+        return true;
+    }
+
+    /** @brief Wake up every waiting thread, for good. */
+    void stop()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    /** @brief Discard every entry and accept new ones again. */
+    void reset()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        clear();
+        stopped_ = false;
+        not_full_.notify_all();
+    }
+
+    /** @brief Change the capacity, keeping the newest entries.
+     *  @returns the number of entries dropped to fit
+     */
+    size_t resize(size_t capacity)
+    {
+        if (capacity == 0)
+            capacity = 1;
+        std::vector<T> ring(capacity);
+        boost::mutex::scoped_lock lock(mutex_);
+        if (capacity == ring_.size())
+            return 0;
+        size_t dropped = size_ > capacity ? size_ - capacity : 0;
+        for (size_t i = dropped; i < size_; ++i)
+            ring[i - dropped] = ring_[(head_ + i) % ring_.size()];
+        ring_.swap(ring);
+        head_ = 0;
+        size_ -= dropped;
+        dropped_ += dropped;
+        not_full_.notify_all();
+        return dropped;
+    }
+
+    Policy policy() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return policy_;
+    }
+
+    /** @brief Change the policy, for the next time the queue is full;
+     *  a producer already waiting keeps waiting.
+     */
+    void setPolicy(Policy policy)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        policy_ = policy;
+    }
+
+    bool stopped() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return stopped_;
+    }
+
+    size_t size() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return ring_.size();
+    }
+
+    /** @brief Entries dropped since construction. */
+    uint64_t dropped() const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        return dropped_;
+    }
+
+private:
+
+    /** move the oldest entry out; the slot is reset, so that it holds
+        no reference to a cloud until it is overwritten */
+    void take(T &item)
+    {
+        item = ring_[head_];
+        ring_[head_] = T();
+        head_ = (head_ + 1) % ring_.size();
+    }
+
+    void clear()
+    {
+        std::fill(ring_.begin(), ring_.end(), T());
+        head_ = 0;
+        size_ = 0;
+    }
+
+    std::vector<T> ring_;
+    size_t head_;
+    size_t size_;
+    Policy policy_;
+    bool stopped_;
+    uint64_t dropped_;
+
+    mutable boost::mutex mutex_;
+    boost::condition_variable not_empty_;
+    boost::condition_variable not_full_;
+};
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_BOUNDED_QUEUE_H_
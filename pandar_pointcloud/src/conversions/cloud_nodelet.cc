@@ -26,7 +26,9 @@ namespace pandar_pointcloud
   public:
 
     CloudNodelet() {}
-    ~CloudNodelet() {}
+
+    /** stop the pipeline before the nodelet manager unloads us */
+    ~CloudNodelet() { conv_.reset(); }
 
   private:
 
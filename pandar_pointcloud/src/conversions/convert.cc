@@ -16,53 +16,402 @@
 
 #include "convert.h"
 
+#include <pandar_pointcloud/trace.h>
+
 #include <pcl_conversions/pcl_conversions.h>
-#include <time.h>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <sstream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 namespace pandar_pointcloud
 {
+/** @brief Parse a list of rings such as "0-15,20" into a mask.
+ *  @returns false if it is malformed
+ */
+static bool parseRings(const std::string &list, uint64_t &rings)
+{
+    rings = 0;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+                return false;
+            p = end;
+        }
+        for (long ring = first; ring <= last && ring < 64; ++ring)
+            rings |= 1ULL << ring;
+        if (*p == ',')
+            ++p;
+        else if (*p)
+            return false;
+    }
+    return true;
+}
+
 /** @brief Constructor. */
 Convert::Convert(ros::NodeHandle node, ros::NodeHandle private_nh):
-    data_(new pandar_rawdata::RawData()), drv(node , private_nh , this)
+    data_(new pandar_rawdata::RawData()), drv(node , private_nh , this),
+    node_(node)
 {
     data_->setup(private_nh);
+    running = false;
+    paused = false;
+    watching = false;
+    tasks_ = 0;
 
     // advertise output point cloud (before subscribing to input data)
     output_ = node.advertise<sensor_msgs::PointCloud2>("pandar_points", 10);
+    frame_info_ =
+        node.advertise<pandar_msgs::PandarFrameInfo>("pandar_frame_info", 10);
+
+    setupOutputs(node, private_nh);
+    setupScan(node, private_nh);
+    setupFeatures(node, private_nh);
+
+    double start_angle;
+    private_nh.param("start_angle", start_angle, 0.0);
+    lidarRotationStartAngle = int(start_angle * 100);
+
+    // frames cut short by lost packets or a restart are only
+    // published if they cover enough of the revolution
+    private_nh.param("min_coverage", minCoverage, 0.0);
+
+    // processes on this host can read the frames from shared memory,
+    // announced on pandar_points_shm, instead of pandar_points
+    std::string shmName;
+    int shmSlots, shmMaxPoints;
+    private_nh.param("shm_name", shmName, std::string(""));
+    private_nh.param("shm_slots", shmSlots, 4);
+    private_nh.param("shm_max_points", shmMaxPoints, 150000);
+    if (!shmName.empty())
+    {
+        shm_.reset(new ShmRingWriter());
+        int rc = shm_->open(shmName, std::max(shmSlots, 1),
+                            std::max(shmMaxPoints, 1));
+        if (rc == 0)
+        {
+            shm_frame_ = node.advertise<pandar_msgs::PandarShmFrame>(
+                             "pandar_points_shm", 10);
+            ROS_INFO("shared memory ring %s: %d slots of %d points",
+                     shmName.c_str(), shmSlots, shmMaxPoints);
+        }
+        else
+        {
+            ROS_ERROR("cannot create shared memory ring %s: %s",
+                      shmName.c_str(), strerror(rc));
+            shm_.reset();
+        }
+    }
+
+    // packets expected per second, followed by shareRotation()
+    const pandar_msgs::RotationRate &rotation = data_->rotationRate();
+    metrics_.reset(new PipelineMetrics(rotation.packetsPerRevolution()
+                                       * rotation.rpm() / 60.0));
+
+    hasGps = 0;
+    frameFirstReceive = 0.0;
+    gps1 = 0;
+    gps2.gps = 0;
+    gps2.used = 1;
+
+    // report the latency of each pipeline stage once a second
+    diagnostics_.setHardwareID("HesaiPandar40");
+    diagnostics_.add("pipeline health", metrics_.get(), &PipelineMetrics::report);
+    diagnostics_.add("pipeline latency", &latency_, &LatencyTracker::report);
+    diagnostics_.add("laser health", this, &Convert::reportLaserHealth);
+    diag_timer_ = node.createTimer(ros::Duration(1.0),
+                                   &Convert::diagTimerCallback, this);
+
+    outMsg.reset(new pandar_rawdata::PPointCloud());
+    lastTimestamp = 0.0;
+
+    // offline_sync replays a PCAP file on a single thread: packets
+    // are read and converted in order, as fast as the decoder allows
+    // with read_fast, and the output is the same on every run
+    std::string pcap;
+    private_nh.param("pcap", pcap, std::string(""));
+    private_nh.param("port", inputPort, (int) DATA_PORT_NUMBER);
+    inputPcap = pcap;
+    private_nh.param("offline_sync", configuredOfflineSync, false);
+
+    // subscribe_packets separates the host receiving the packets from
+    // the one converting them: pandar_driver publishes PandarScan
+    // batches of npackets/3 packets, each converted in one call
+    private_nh.param("subscribe_packets", subscribePackets, false);
+    if (subscribePackets)
+    {
+        ROS_INFO("converting the pandar_packets of a pandar_driver");
+        if (!pcap.empty())
+            ROS_WARN("subscribe_packets: pcap is ignored");
+        pcap.clear();
+    }
+    // sensors sharing a PPS source agree on the UTC second of their
+    // packets; a replay keeps its own GPS times
+    bool sharedTimeBase;
+    private_nh.param("shared_time_base", sharedTimeBase, false);
+    timeBase_ = NULL;
+    lastPulse = 0.0;
+    if (sharedTimeBase && !pcap.empty())
+    {
+        ROS_WARN("shared_time_base is ignored for PCAP input");
+    }
+    else if (sharedTimeBase)
+    {
+        timeBase_ = &pandar_rawdata::TimeBase::instance();
+        data_->setTimeBase(timeBase_);
+        diagnostics_.add("time base", this, &Convert::reportTimeBase);
+    }
+
+    // the packet queue holds at most queue_size packets or, by
+    // default, QUEUE_REVOLUTIONS revolutions at the rotation rate
+    // measured, half a second at 600 RPM.  Its queue_policy depends on
+    // the input, and is set by configureInput()
+    int queueSize;
+    private_nh.param("queue_size", queueSize, 0);
+    queueRevolutions = queueSize > 0 ? 0 : QUEUE_REVOLUTIONS;
+    revolutionPackets = data_->rotationRate().packetsPerRevolution();
+    sharedRotation_ = data_->rotationRate();
+    rotationChanges = sharedRotation_.changes();
+    if (queueRevolutions)
+        queueSize = queueRevolutions * revolutionPackets;
+    private_nh.param("queue_policy", configuredQueuePolicy, std::string(""));
+    packetQueue_.reset(new BoundedQueue<QueuedPacket>(
+        std::max(queueSize, 1), BoundedQueue<QueuedPacket>::DROP_OLDEST));
+    framePacketsDropped = false;
+    ROS_INFO("packet queue: %d packets", queueSize);
+
+    // converted frames wait here for the publishing task.  A frame
+    // is only dropped if subscribers keep publishing behind for
+    // publish_queue_size frames, and then the newest frames are kept
+    int publishQueueSize;
+    private_nh.param("publish_queue_size", publishQueueSize, 2);
+    publishQueue_.reset(new BoundedQueue<ConvertedFrame>(
+        std::max(publishQueueSize, 1),
+        BoundedQueue<ConvertedFrame>::DROP_OLDEST));
+    configureInput(pcap);
+
+    // the work of every sensor in the process runs on one executor,
+    // sized by the executor_threads and executor_affinity of the first
+    int executorThreads;
+    std::string executorAffinity;
+    private_nh.param("executor_threads", executorThreads, 0);
+    private_nh.param("executor_affinity", executorAffinity, std::string(""));
+    executor_ = &Executor::instance(executorThreads, executorAffinity);
+    convertStrand_.reset(new Strand(*executor_));
+    publishStrand_.reset(new Strand(*executor_));
+    convertScheduled = false;
+    publishScheduled = false;
 
+    start();
+
+    // the pipeline exists now: reconfiguring may pause it or switch
+    // its input
     srv_ = boost::make_shared <dynamic_reconfigure::Server<pandar_pointcloud::
            CloudNodeConfig> > (private_nh);
     dynamic_reconfigure::Server<pandar_pointcloud::CloudNodeConfig>::
     CallbackType f;
     f = boost::bind (&Convert::callback, this, _1, _2);
     srv_->setCallback (f);
-    double start_angle;
-    private_nh.param("start_angle", start_angle, 0.0);
-    lidarRotationStartAngle = int(start_angle * 100);
+}
 
-    hasGps = 0;
-    // subscribe to PandarScan packets
-    // pandar_scan_ =
-    //     node.subscribe("pandar_packets", 100,
-    //                    &Convert::processScan, (Convert *) this,
-    //                    ros::TransportHints().tcpNoDelay(true));
-    // pandar_gps_ =
-    //     node.subscribe("pandar_gps", 1,
-    //                    &Convert::processGps, (Convert *) this,
-    //                    ros::TransportHints().tcpNoDelay(true));
+Convert::~Convert()
+{
+    srv_.reset();
+    stop();
+}
 
-    sem_init(&picsem, 0, 0);
-    pthread_mutex_init(&piclock, NULL);
+void Convert::start()
+{
+    boost::mutex::scoped_lock lock(lifecycleMutex_);
+    if (running)
+        return;
+    running = true;
+
+    if (subscribePackets)
+    {
+        pandar_scan_ =
+            node_.subscribe("pandar_packets", 100,
+                            &Convert::processScan, (Convert *) this,
+                            ros::TransportHints().tcpNoDelay(true));
+        // processGps is overloaded for the in-process driver
+        void (Convert::*gpsCallback)(const pandar_msgs::PandarGps::ConstPtr &)
+            = &Convert::processGps;
+        pandar_gps_ =
+            node_.subscribe("pandar_gps", 1,
+                            gpsCallback, (Convert *) this,
+                            ros::TransportHints().tcpNoDelay(true));
+        return;
+    }
 
-    boost::thread thrd(boost::bind(&Convert::DriverReadThread, this));
-    boost::thread processThr(boost::bind(&Convert::processLiDARData, this));
+    // a reader blocked on a full queue must not hold an executor
+    // worker: the conversion it waits for runs on the same executor
+    int rc = -1;
+    if (drv.fd() >= 0
+        && packetQueue_->policy() != BoundedQueue<QueuedPacket>::BLOCK)
+    {
+        rc = executor_->watch(drv.fd(),
+                              boost::bind(&Convert::notifyReceive, this));
+        if (rc != 0)
+            ROS_ERROR("cannot watch the Pandar socket: %s, reading it on"
+                      " a thread", strerror(rc));
+    }
+    watching = (rc == 0);
+    if (!watching)
+    {
+        // PCAP replay paces itself with sleeps, and a blocking reader
+        // waits for the queue: both keep their own thread
+        readThread_ = boost::thread(boost::bind(&Convert::DriverReadThread,
+                                                this));
+    }
+}
+
+void Convert::stop()
+{
+    boost::mutex::scoped_lock lock(lifecycleMutex_);
+    if (!running.exchange(false))
+        return;
+
+    // shutdown() waits for a subscription callback in progress
+    pandar_scan_.shutdown();
+    pandar_gps_.shutdown();
+
+    // no receive task is posted once the socket is unwatched
+    if (watching)
+        executor_->unwatch(drv.fd());
+    watching = false;
+
+    // wake a reader blocked on a full queue, and wait for it
+    packetQueue_->stop();
+    if (readThread_.joinable())
+        readThread_.join();
+
+    {
+        boost::mutex::scoped_lock tasksLock(tasksMutex_);
+        while (tasks_ > 0)
+            tasksDone_.wait(tasksLock);
+    }
+
+    // the next start() begins with a new frame
+    packetQueue_->reset();
+    publishQueue_->reset();
+    data_->reset();
+    outMsg->clear();
+    frameFirstReceive = 0.0;
+    framePacketsDropped = false;
+}
+
+void Convert::pause(bool pause)
+{
+    if (paused.exchange(pause) == pause)
+        return;
+    ROS_INFO("%s", pause ? "paused" : "resumed");
+    // the frame in progress lost its packets while paused
+    if (!pause)
+        framePacketsDropped = true;
+}
+
+void Convert::reopenInput(const std::string &pcap, int port)
+{
+    if (subscribePackets)
+    {
+        ROS_WARN("subscribe_packets: the input belongs to pandar_driver");
+        return;
+    }
+    stop();
+    {
+        boost::mutex::scoped_lock lock(lifecycleMutex_);
+        if (pcap.empty())
+            ROS_INFO("reading the Pandar socket on port %d", port);
+        else
+            ROS_INFO_STREAM("replaying " << pcap);
+        drv.openInput(pcap, port);
+        inputPcap = pcap;
+        inputPort = port;
+        configureInput(pcap);
+    }
+    start();
+}
+
+/** @brief Apply offline_sync and queue_policy to the input, a PCAP
+ *  file or, if pcap is empty, the socket; only while stopped.
+ */
+void Convert::configureInput(const std::string &pcap)
+{
+    offlineSync = configuredOfflineSync;
+    if (offlineSync && pcap.empty())
+    {
+        ROS_WARN("offline_sync needs a pcap file, ignored for live input");
+        offlineSync = false;
+    }
+    else if (offlineSync)
+    {
+        ROS_INFO("converting PCAP packets synchronously");
+    }
+
+    // when conversion falls behind:
+    //   drop_oldest -- the oldest packets make room
+    //   drop_frame  -- the queued packets and the frame they belong to
+    //                  are dropped, only whole frames are published
+    //   block       -- reading waits for conversion, for PCAP replay
+    std::string queuePolicy = configuredQueuePolicy;
+    if (queuePolicy.empty())
+        queuePolicy = pcap.empty() ? "drop_oldest" : "block";
+    BoundedQueue<QueuedPacket>::Policy policy =
+        BoundedQueue<QueuedPacket>::DROP_OLDEST;
+    dropFrame = false;
+    if (queuePolicy == "drop_frame")
+    {
+        policy = BoundedQueue<QueuedPacket>::DROP_ALL;
+        dropFrame = true;
+    }
+    else if (queuePolicy == "block")
+    {
+        policy = BoundedQueue<QueuedPacket>::BLOCK;
+        if (pcap.empty())
+            ROS_WARN("queue_policy block with live input: the socket is"
+                     " read on its own thread, and packets conversion"
+                     " cannot keep up with are lost in the socket buffer");
+    }
+    else if (queuePolicy != "drop_oldest")
+    {
+        ROS_WARN_STREAM("unknown queue_policy " << queuePolicy
+                        << ", using drop_oldest");
+        queuePolicy = "drop_oldest";
+    }
+    packetQueue_->setPolicy(policy);
+    ROS_INFO("packet queue policy: %s", queuePolicy.c_str());
+
+    publishInline = offlineSync || policy == BoundedQueue<QueuedPacket>::BLOCK;
 }
 
 void Convert::DriverReadThread()
 {
-    while(1)
+    while (running)
     {
-        drv.poll();
+        // a paused replay keeps its place in the file
+        if (paused)
+        {
+            usleep(10000);
+            continue;
+        }
+        if (!drv.poll() && offlineSync)
+        {
+            ROS_INFO("end of PCAP file, offline conversion done");
+            return;
+        }
     }
 }
 
@@ -72,160 +421,670 @@ void Convert::callback(pandar_pointcloud::CloudNodeConfig &config,
     ROS_INFO("Reconfigure Request");
     data_->setParameters(config.min_range, config.max_range, config.view_direction,
                          config.view_width);
+    if (config.paused != paused)
+        pause(config.paused);
+    if (config.pcap != inputPcap || config.port != inputPort)
+        reopenInput(config.pcap, config.port);
 }
 
-/** @brief Callback for raw scan messages. */
+/** @brief Callback for raw scan messages, with subscribe_packets.
+ *
+ *  The whole batch is converted in one pass, closing the frames it
+ *  ends as processPacket() does.
+ */
 void Convert::processScan(const pandar_msgs::PandarScan::ConstPtr &scanMsg)
 {
-    if (output_.getNumSubscribers() == 0)         // no one listening?
+    if (paused)
+        return;
+
+    double receiveTime = ros::WallTime::now().toSec();
+    const std::vector<pandar_msgs::PandarPacket> &packets = scanMsg->packets;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        metrics_->packetReceived();
+        metrics_->packetTimestamp(pandar_msgs::packetUsec(packets[i]));
+    }
+    if (timeBase_ && !packets.empty())
+        lastPulse = packets.back().stamp.toSec()
+                    - pandar_msgs::packetUsec(packets.back()) * 1e-6;
+
+    if (!shm_ && !listening())                      // no one listening?
         return;                                     // avoid much work
 
-    // allocate a point cloud with same time and frame ID as raw data
-    pandar_rawdata::PPointCloud::Ptr outMsg(new pandar_rawdata::PPointCloud());
-    // outMsg's header is a pcl::PCLHeader, convert it before stamp assignment
-    outMsg->header.stamp = pcl_conversions::toPCL(scanMsg->header).stamp;
-    // pcl_conversions::toPCL(ros::Time::now(), outMsg->header.stamp);
-    // outMsg->is_dense = false;
-    outMsg->header.frame_id = scanMsg->header.frame_id;
+    if (framePacketsDropped.exchange(false))
+    {
+        data_->reset();
+        outMsg->clear();
+    }
+    outMsg->header.frame_id = "pandar";
     outMsg->height = 1;
 
-    // process each packet provided by the driver
-    // for (size_t i = 0; i < scanMsg->packets.size(); ++i)
-    // {
-    //     data_->unpack(scanMsg->packets[i], *outMsg);
-    // }
-    double firstStamp = 0.0f;
-    int ret = data_->unpack(scanMsg, *outMsg , gps1 , gps2 , firstStamp, lidarRotationStartAngle);
+    size_t next = 0;
+    while (next < packets.size())
+    {
+        double convertStart = ros::WallTime::now().toSec();
+        double firstStamp = 0.0f;
+        if (data_->unpack(*scanMsg, next, *outMsg, gps1, gps2, firstStamp,
+                          lidarRotationStartAngle) == 1)
+        {
+            finishFrame(firstStamp, convertStart, receiveTime);
+            outMsg->header.frame_id = "pandar";
+            outMsg->height = 1;
+        }
+    }
+}
+
+void Convert::processGps(pandar_msgs::PandarGps &gpsMsg)
+{
+    metrics_->gpsReceived();
+    pandar_rawdata::updateGps(gpsMsg, gps2);
+    // once the time base has GPS times, frames carry them
+    if (timeBase_ && lastPulse != 0.0 && timeBase_->addGps(gps2.gps, lastPulse))
+        hasGps = 1;
+}
 
-    // publish the accumulated cloud message
-	ROS_DEBUG_STREAM("Publishing " << outMsg->height * outMsg->width
-					 << " Pandar40 points, time: " << outMsg->header.stamp);
+void Convert::pushLiDARData(const pandar_msgs::PandarPacket &packet,
+                            double receive_time)
+{
+    if (paused)
+        return;
 
-    if(ret == 1)
+    QueuedPacket item;
+    item.packet = packet;
+    item.receive_time = receive_time;
+    item.enqueue_time = ros::WallTime::now().toSec();
+    latency_.add(LatencyTracker::RECEIVE, item.enqueue_time - receive_time);
+
+    metrics_->packetReceived();
+    if (timeBase_)
+        lastPulse = packet.stamp.toSec()
+                    - pandar_msgs::packetUsec(packet) * 1e-6;
+
+    // offline_sync: convert on the reading thread, which then waits
+    // for the decoder instead of filling the queue
+    if (offlineSync)
+    {
+        PANDAR_TRACE2(enqueue, 0, (uint64_t) (item.enqueue_time * 1e9));
+        processPacket(item, 0);
+        return;
+    }
+
+    size_t dropped = packetQueue_->push(item);
+    if (dropped)
     {
-        pcl_conversions::toPCL(ros::Time(firstStamp), outMsg->header.stamp);
-        output_.publish(outMsg);
+        metrics_->packetDropped(dropped);
+        if (dropFrame)
+            framePacketsDropped = true;
     }
+    size_t depth = packetQueue_->size();
+    metrics_->queueDepth(depth);
+    PANDAR_TRACE2(enqueue, depth, (uint64_t) (item.enqueue_time * 1e9));
+    scheduleConvert();
 }
 
-void Convert::processGps(pandar_msgs::PandarGps &gpsMsg)
+/** @brief Count a task about to be posted, see stop(). */
+void Convert::taskPosted()
+{
+    boost::mutex::scoped_lock lock(tasksMutex_);
+    ++tasks_;
+}
+
+/** @brief Called last by every task. */
+void Convert::taskDone()
 {
+    boost::mutex::scoped_lock lock(tasksMutex_);
+    if (--tasks_ == 0)
+        tasksDone_.notify_all();
+}
 
-    struct tm t;
-    t.tm_sec = gpsMsg.second;
-    t.tm_min = gpsMsg.minute;
-    t.tm_hour = gpsMsg.hour;
-    t.tm_mday = gpsMsg.day;
-    t.tm_mon = gpsMsg.month - 1;
-    t.tm_year = gpsMsg.year + 2000 - 1900;
-    t.tm_isdst = 0;
-    if(lastGPSSecond != (mktime(&t) + 1))
+/** @brief The socket became readable, on the watching thread. */
+void Convert::notifyReceive()
+{
+    taskPosted();
+    executor_->post(boost::bind(&Convert::receivePackets, this));
+}
+
+/** @brief Receive task: read what the socket holds, in batches so that
+ *  the other sensors get their turn.
+ */
+void Convert::receivePackets()
+{
+    static const int RECEIVE_BATCH = 64;
+    if (running)
     {
-        lastGPSSecond = (mktime(&t) + 1);
-        gps2.gps = mktime(&t) + 1; // the gps always is the last gps, the newest GPS data is after the PPS(Serial port transmition speed...)
-        gps2.used = 0;
+        if (drv.readAvailable(RECEIVE_BATCH) == RECEIVE_BATCH)
+        {
+            taskPosted();
+            executor_->post(boost::bind(&Convert::receivePackets, this));
+        }
+        else
+        {
+            executor_->rearm(drv.fd());
+        }
     }
-     // ROS_ERROR("Got a gps data %d " ,gps2.gps);
+    taskDone();
 }
 
-void Convert::pushLiDARData(pandar_msgs::PandarPacket packet)
+void Convert::scheduleConvert()
 {
-    pthread_mutex_lock(&piclock);
-    LiDARDataSet.push_back(packet);
-    if(LiDARDataSet.size() > 6)
+    if (!convertScheduled.exchange(true))
     {
-        sem_post(&picsem);
+        taskPosted();
+        convertStrand_->post(boost::bind(&Convert::convertPackets, this));
     }
-    pthread_mutex_unlock(&piclock);
+}
 
+/** @brief Conversion task: convert the queued packets, in batches. */
+void Convert::convertPackets()
+{
+    static const int CONVERT_BATCH = 256;
+
+    // packets queued from now on schedule another run
+    convertScheduled = false;
+    QueuedPacket item;
+    size_t depth;
+    int i;
+    for (i = 0; i < CONVERT_BATCH; ++i)
+    {
+        if (!packetQueue_->tryPop(item, depth))
+            break;
+        processPacket(item, depth);
+    }
+    if (i == CONVERT_BATCH)
+        scheduleConvert();
+    taskDone();
 }
 
-int Convert::processLiDARData()
+/** @brief Convert one packet, publishing the frame it may close. */
+void Convert::processPacket(QueuedPacket &item, size_t depth)
 {
-    double lastTimestamp = 0.0f;
-    pandar_rawdata::PPointCloud::Ptr outMsg(new pandar_rawdata::PPointCloud());
-    int frame_id = 0;
-    struct timespec ts;
-    while(1)
+    if (framePacketsDropped.exchange(false))
+    {
+        data_->reset();
+        outMsg->clear();
+    }
+
+    double dequeueTime = ros::WallTime::now().toSec();
+    PANDAR_TRACE2(dequeue, depth,
+                  (uint64_t) ((dequeueTime - item.enqueue_time) * 1e9));
+    latency_.add(LatencyTracker::QUEUE, dequeueTime - item.enqueue_time);
+
+    metrics_->packetTimestamp(pandar_msgs::packetUsec(item.packet));
+
+    // a replay converts everything, so its output never depends on
+    // when subscribers come and go; shared memory readers can not be
+    // counted, so with a ring every frame is converted too
+    if (!offlineSync && !shm_ && !listening())     // no one listening?
     {
-        if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+        // the driver still follows the rotation rate
+        if (data_->measureRotation(item.packet))
+            shareRotation();
+        return;                                     // avoid much work
+    }
+
+    // outMsg's header is a pcl::PCLHeader, convert it before stamp assignment
+    // pcl_conversions::toPCL(ros::Time::now(), outMsg->header.stamp);
+    // outMsg->is_dense = false;
+    outMsg->header.frame_id = "pandar";
+    outMsg->height = 1;
+
+    double firstStamp = 0.0f;
+    int ret = data_->unpack(item.packet, *outMsg , gps1 , gps2 , firstStamp, lidarRotationStartAngle);
+    if (data_->rotationRate().changes() != rotationChanges)
+        shareRotation();
+
+    if(ret == 1)
+    {
+        // the frame boundary is found while unpacking the packet
+        // that closes the frame, which then converts all of it
+        finishFrame(firstStamp, dequeueTime, item.receive_time);
+    }
+}
+
+/** @brief Stamp and hand over the frame just assembled in outMsg.
+ *
+ *  @param convertStart wall clock when its closing packet was taken
+ *  @param receiveTime receive time of its closing packet
+ */
+void Convert::finishFrame(double firstStamp, double convertStart,
+                          double receiveTime)
+{
+    double convertEnd = ros::WallTime::now().toSec();
+    latency_.add(LatencyTracker::CONVERT, convertEnd - convertStart);
+
+    // ROS_ERROR("timestamp : %f " , firstStamp);
+    if(lastTimestamp != 0.0f)
+    {
+        if(lastTimestamp > firstStamp)
         {
-            ROS_ERROR("get time error");
+            ROS_ERROR("errrrrrrrrr");
         }
+    }
+
+    lastTimestamp = firstStamp;
+    // a replay is stamped with the data time, to be reproducible
+    if(hasGps || offlineSync)
+    {
+      pcl_conversions::toPCL(ros::Time(firstStamp), outMsg->header.stamp);
+    }
+    else
+    {
+      pcl_conversions::toPCL(ros::Time::now(), outMsg->header.stamp);
+    }
+    const pandar_rawdata::frame_info_t &info = data_->frameInfo();
+    bool complete = info.coverage >= minCoverage;
+    metrics_->frame(outMsg->points.size(), info.coverage, hasGps, complete);
+
+    ConvertedFrame frame;
+    frame.cloud = outMsg;
+    frame.info.reset(new pandar_msgs::PandarFrameInfo);
+    pcl_conversions::fromPCL(outMsg->header, frame.info->header);
+    frame.info->blocks = info.blocks;
+    frame.info->expected_blocks = info.expected_blocks;
+    frame.info->missing_blocks = info.missing_blocks;
+    frame.info->reordered_blocks = info.reordered_blocks;
+    frame.info->azimuth_step = info.azimuth_step;
+    frame.info->coverage = info.coverage;
+    frame.info->rpm = info.rpm;
+    frame.info->published = complete;
+    for (size_t n = 0; n < data_->outputs(); ++n)
+    {
+        pandar_rawdata::PPointCloud::Ptr cloud = data_->takeOutput(n);
+        cloud->header = outMsg->header;
+        cloud->height = 1;
+        frame.outputs.push_back(cloud);
+    }
+    if (scanBins > 0)
+    {
+        frame.scan.reset(new sensor_msgs::LaserScan);
+        frame.scan->header = frame.info->header;
+        frame.scan->angle_increment = 2 * M_PI / scanBins;
+        // each bin is labeled by the angle at its center
+        frame.scan->angle_min = -M_PI + frame.scan->angle_increment / 2;
+        frame.scan->angle_max = frame.scan->angle_min
+                                + (scanBins - 1) * frame.scan->angle_increment;
+        frame.scan->scan_time = info.rpm > 0 ? 60.0 / info.rpm : 0.0;
+        frame.scan->time_increment = frame.scan->scan_time / scanBins;
+        frame.scan->range_min = scanMinRange;
+        frame.scan->range_max = scanMaxRange;
+        data_->takeScan(frame.scan->ranges, frame.scan->intensities);
+    }
+    if (data_->features())
+    {
+        frame.edges = data_->features()->takeEdges();
+        frame.edges->header = outMsg->header;
+        frame.edges->height = 1;
+        frame.planars = data_->features()->takePlanars();
+        frame.planars->header = outMsg->header;
+        frame.planars->height = 1;
+    }
+    frame.first_receive = frameFirstReceive;
+    frame.last_receive = receiveTime;
+    frame.convert_end = convertEnd;
+
+    if (publishInline)
+    {
+        publishFrame(frame);
+    }
+    else
+    {
+        size_t dropped = publishQueue_->push(frame);
+        if (dropped)
+            metrics_->frameDropped(dropped);
+        schedulePublish();
+    }
+
+    // the cloud now belongs to the publishing stage and, through
+    // the nodelet manager, to subscribers: start a new one, sized
+    // like the last unless the rotation rate changed
+    size_t points = outMsg->points.size();
+    int revolution = data_->rotationRate().packetsPerRevolution();
+    if (revolution != revolutionPackets)
+    {
+        points = points * revolution / revolutionPackets;
+        resizeQueue(revolution);
+    }
+    outMsg.reset(new pandar_rawdata::PPointCloud());
+    outMsg->points.reserve(points);
+
+    // the closing packet also starts the next frame
+    frameFirstReceive = receiveTime;
+}
+
+/** @brief Hand the rotation rate measured to the driver thread, and
+ *  to the lost packet count of the metrics.
+ */
+void Convert::shareRotation()
+{
+    const pandar_msgs::RotationRate &rotation = data_->rotationRate();
+    metrics_->setPacketRate(rotation.packetsPerRevolution()
+                            * rotation.rpm() / 60.0);
+    boost::mutex::scoped_lock lock(rotationMutex_);
+    sharedRotation_ = rotation;
+    rotationChanges = sharedRotation_.changes();
+}
+
+bool Convert::rotationChanged(int &changes,
+                              pandar_msgs::RotationRate &rotation)
+{
+    if (rotationChanges == changes)
+        return false;
+    boost::mutex::scoped_lock lock(rotationMutex_);
+    rotation = sharedRotation_;
+    changes = rotation.changes();
+    return true;
+}
+
+/** @brief Follow a new rotation rate with the packet queue, unless
+ *  queue_size fixed it.
+ *
+ *  @param revolution packets per revolution now
+ */
+void Convert::resizeQueue(int revolution)
+{
+    revolutionPackets = revolution;
+    if (!queueRevolutions)
+        return;
+    size_t dropped = packetQueue_->resize(queueRevolutions * revolution);
+    if (dropped)
+    {
+        metrics_->packetDropped(dropped);
+        if (dropFrame)
+            framePacketsDropped = true;
+    }
+    ROS_INFO("packet queue: %d packets", queueRevolutions * revolution);
+}
 
-        ts.tv_sec += 1;
-        if (sem_timedwait(&picsem, &ts) == -1)
+/** @brief Set up the additional outputs named in the outputs parameter.
+ *
+ *  Each is configured in the private namespace of its name:
+ *
+ *    topic                  -- pandar_points_<name> by default
+ *    rings                  -- lasers kept, as in "0-15,20"; all by default
+ *    min_azimuth, max_azimuth -- degrees in the device frame, the
+ *                              crop may wrap past 0; none by default
+ *    min_range, max_range   -- meters
+ *    decimation             -- one firing out of decimation is kept
+ *
+ *  The outputs are filled from the points decoded for pandar_points,
+ *  and published with it.
+ */
+void Convert::setupOutputs(ros::NodeHandle node, ros::NodeHandle private_nh)
+{
+    std::string names;
+    private_nh.param("outputs", names, std::string(""));
+    std::replace(names.begin(), names.end(), ',', ' ');
+    std::istringstream list(names);
+    std::vector<pandar_rawdata::output_filter_t> filters;
+    std::string name;
+    while (list >> name)
+    {
+        ros::NodeHandle output_nh(private_nh, name);
+        std::string topic, rings;
+        double minAzimuth, maxAzimuth;
+        pandar_rawdata::output_filter_t filter;
+        output_nh.param("topic", topic, "pandar_points_" + name);
+        output_nh.param("rings", rings, std::string("0-63"));
+        output_nh.param("min_azimuth", minAzimuth, 0.0);
+        output_nh.param("max_azimuth", maxAzimuth, 0.0);
+        output_nh.param("min_range", filter.min_range, 0.0);
+        output_nh.param("max_range", filter.max_range, 1000.0);
+        output_nh.param("decimation", filter.decimation, 1);
+        if (!parseRings(rings, filter.rings))
         {
-            // ROS_INFO("No Pic");
-            continue;
+            ROS_WARN_STREAM("output " << name << ": bad rings " << rings
+                            << ", keeping all");
+            filter.rings = ~0ULL;
         }
-        pthread_mutex_lock(&piclock);
-        pandar_msgs::PandarPacket packet = LiDARDataSet.front();
-        LiDARDataSet.pop_front();
-        pthread_mutex_unlock(&piclock);
+        filter.min_azimuth = int(fmod(fmod(minAzimuth, 360.0) + 360.0, 360.0) * 100);
+        filter.max_azimuth = int(fmod(fmod(maxAzimuth, 360.0) + 360.0, 360.0) * 100);
+        filters.push_back(filter);
+        outputPubs_.push_back(
+            node.advertise<sensor_msgs::PointCloud2>(topic, 10));
+        ROS_INFO("output %s on %s: rings %s, azimuth %.2f-%.2f,"
+                 " range %.2f-%.2f m, decimation %d", name.c_str(),
+                 topic.c_str(), rings.c_str(), minAzimuth, maxAzimuth,
+                 filter.min_range, filter.max_range, filter.decimation);
+    }
+    data_->setOutputs(filters);
+    outputPubs_.resize(data_->outputs());
+}
 
-        if (output_.getNumSubscribers() == 0)         // no one listening?
-                continue;                                     // avoid much work
+/** @brief Set up the scan output, from the rings in scan_rings.
+ *
+ *  Each scan_resolution degrees bin of the scan is the nearest point
+ *  of the rings in the x-y plane, between scan_min_range and
+ *  scan_max_range.  RawData fills it while decoding: no cloud of the
+ *  rings is built for it.
+ */
+void Convert::setupScan(ros::NodeHandle node, ros::NodeHandle private_nh)
+{
+    std::string rings;
+    double resolution;
+    private_nh.param("scan_rings", rings, std::string(""));
+    private_nh.param("scan_resolution", resolution, 0.2);
+    private_nh.param("scan_min_range", scanMinRange, 0.5);
+    private_nh.param("scan_max_range", scanMaxRange, 130.0);
+    scanBins = 0;
+    if (rings.empty())
+        return;
 
-        // outMsg's header is a pcl::PCLHeader, convert it before stamp assignment
-        // pcl_conversions::toPCL(ros::Time::now(), outMsg->header.stamp);
-        // outMsg->is_dense = false;
-        outMsg->header.frame_id = "pandar";
-        outMsg->height = 1;
+    pandar_rawdata::scan_band_t band;
+    if (!parseRings(rings, band.rings) || band.rings == 0)
+    {
+        ROS_ERROR_STREAM("bad scan_rings " << rings << ", no scan");
+        return;
+    }
+    if (resolution <= 0.0)
+        resolution = 0.2;
+    band.bins = (int) ceil(360.0 / resolution - 1e-6);
+    band.min_range = scanMinRange;
+    band.max_range = scanMaxRange;
+    data_->setScanBand(band);
+    scanBins = band.bins;
+    scan_ = node.advertise<sensor_msgs::LaserScan>("scan", 10);
+    ROS_INFO("scan from rings %s: %d bins, range %.2f-%.2f m",
+             rings.c_str(), scanBins, scanMinRange, scanMaxRange);
+}
 
+/** @brief Set up the feature outputs, when features is set.
+ *
+ *  Each ring is cut in feature_sectors sectors per turn.  A sector
+ *  gives at most feature_edges edge points, smoothness above
+ *  edge_threshold, and feature_planars planar points, smoothness below
+ *  planar_threshold, as in LOAM.  RawData picks them while decoding.
+ */
+void Convert::setupFeatures(ros::NodeHandle node, ros::NodeHandle private_nh)
+{
+    bool features;
+    pandar_rawdata::feature_config_t config;
+    private_nh.param("features", features, false);
+    private_nh.param("feature_sectors", config.sectors, 6);
+    private_nh.param("feature_edges", config.edges, 2);
+    private_nh.param("feature_planars", config.planars, 4);
+    private_nh.param("edge_threshold", config.edge_threshold, 0.1);
+    private_nh.param("planar_threshold", config.planar_threshold, 0.1);
+    if (!features)
+        return;
 
+    data_->setFeatures(config);
+    edges_ = node.advertise<sensor_msgs::PointCloud2>("pandar_edges", 10);
+    planars_ = node.advertise<sensor_msgs::PointCloud2>("pandar_planars", 10);
+    ROS_INFO("features: %d sectors, %d edges above %.3f, "
+             "%d planar points below %.3f per sector",
+             config.sectors, config.edges, config.edge_threshold,
+             config.planars, config.planar_threshold);
+}
 
-        double firstStamp = 0.0f;
-        int ret = data_->unpack(packet, *outMsg , gps1 , gps2 , firstStamp, lidarRotationStartAngle);
+/** @brief Whether any output has subscribers. */
+bool Convert::listening()
+{
+    if (output_.getNumSubscribers() > 0)
+        return true;
+    for (size_t n = 0; n < outputPubs_.size(); ++n)
+    {
+        if (outputPubs_[n].getNumSubscribers() > 0)
+            return true;
+    }
+    if (data_->features()
+        && (edges_.getNumSubscribers() > 0
+            || planars_.getNumSubscribers() > 0))
+        return true;
+    return scanBins > 0 && scan_.getNumSubscribers() > 0;
+}
 
+void Convert::schedulePublish()
+{
+    if (!publishScheduled.exchange(true))
+    {
+        taskPosted();
+        publishStrand_->post(boost::bind(&Convert::publishFrames, this));
+    }
+}
 
+/** @brief Publishing task: publish the queued frames. */
+void Convert::publishFrames()
+{
+    publishScheduled = false;
+    ConvertedFrame frame;
+    size_t depth;
+    while (publishQueue_->tryPop(frame, depth))
+    {
+        publishFrame(frame);
+    }
+    taskDone();
+}
 
-        if(ret == 1)
+/** @brief Publish a converted frame and its completeness. */
+void Convert::publishFrame(const ConvertedFrame &frame)
+{
+    double publishStart = ros::WallTime::now().toSec();
+    const pandar_rawdata::PPointCloud::Ptr &cloud = frame.cloud;
+    if (frame.info->published)
+    {
+        output_.publish(cloud);
+        for (size_t n = 0; n < frame.outputs.size(); ++n)
+            outputPubs_[n].publish(frame.outputs[n]);
+        if (frame.scan)
+            scan_.publish(frame.scan);
+        if (frame.edges)
         {
-            // ROS_ERROR("timestamp : %f " , firstStamp);
-            if(lastTimestamp != 0.0f)
-            {
-                if(lastTimestamp > firstStamp)
-                {
-                    ROS_ERROR("errrrrrrrrr");
-                }
-            }
-
-            lastTimestamp = firstStamp;
-            if(hasGps)
-            {
-              pcl_conversions::toPCL(ros::Time(firstStamp), outMsg->header.stamp);
-            }
-            else
-            {
-              pcl_conversions::toPCL(ros::Time::now(), outMsg->header.stamp);
-            }
-            output_.publish(outMsg);
-            outMsg->clear();
+            edges_.publish(frame.edges);
+            planars_.publish(frame.planars);
+        }
+        if (shm_)
+            writeShm(*cloud);
+        // pcl stamps are in microseconds
+        PANDAR_TRACE2(publish, cloud->points.size(),
+                      cloud->header.stamp * 1000);
+    }
+    else
+    {
+        ROS_DEBUG("suppressed frame covering %.3f of a revolution",
+                  frame.info->coverage);
+    }
+    frame_info_.publish(frame.info);
 
+    double publishEnd = ros::WallTime::now().toSec();
+    latency_.add(LatencyTracker::PUBLISH, publishEnd - frame.convert_end);
+    latency_.add(LatencyTracker::END_TO_END,
+                 publishEnd - frame.last_receive);
+    if (frame.first_receive != 0.0)
+        latency_.add(LatencyTracker::FRAME,
+                     publishEnd - frame.first_receive);
+    ROS_DEBUG("frame receive %.6f-%.6f converted %.6f publish %.6f-%.6f",
+              frame.first_receive, frame.last_receive, frame.convert_end,
+              publishStart, publishEnd);
+}
 
-        }
+/** @brief Copy a frame into the shared memory ring and announce it. */
+void Convert::writeShm(const pandar_rawdata::PPointCloud &pc)
+{
+    uint32_t slot;
+    uint64_t sequence = shm_->write(pc, slot);
+    if (sequence == 0)
+    {
+        ROS_WARN_THROTTLE(10, "frame of %zu points does not fit the shared"
+                          " memory ring, raise shm_max_points",
+                          pc.points.size());
+        return;
+    }
+
+    pandar_msgs::PandarShmFramePtr frameMsg(new pandar_msgs::PandarShmFrame);
+    pcl_conversions::fromPCL(pc.header, frameMsg->header);
+    frameMsg->segment = shm_->name();
+    frameMsg->sequence = sequence;
+    frameMsg->slot = slot;
+    frameMsg->points = pc.points.size();
+    frameMsg->point_step = sizeof(pandar_rawdata::PPoint);
+    shm_frame_.publish(frameMsg);
+}
+
+/** @brief Diagnostic task, statistics of each laser over the last frames. */
+void Convert::reportLaserHealth(diagnostic_updater::DiagnosticStatusWrapper &status)
+{
+    static const char *names[] = {"ok", "degraded", "dead"};
+    pandar_rawdata::laser_stats_t stats[pandar_rawdata::LaserHealth::LASERS];
+    int frames = data_->laserHealth().snapshot(stats);
+
+    std::string dead, degraded;
+    for (int i = 0; i < pandar_rawdata::LaserHealth::LASERS; ++i)
+    {
+        std::string id = boost::lexical_cast<std::string>(i);
+        if (stats[i].status == pandar_rawdata::laser_stats_t::DEAD)
+            dead += (dead.empty() ? "" : " ") + id;
+        else if (stats[i].status == pandar_rawdata::laser_stats_t::DEGRADED)
+            degraded += (degraded.empty() ? "" : " ") + id;
+        status.addf("laser " + id,
+                    "%s returns/frame=%.0f range=%.2fm intensity=%.1f zero=%.3f",
+                    names[stats[i].status], stats[i].returns_per_frame,
+                    stats[i].mean_range, stats[i].mean_intensity,
+                    stats[i].zero_ratio);
     }
+
+    if (frames == 0)
+        status.summary(diagnostic_msgs::DiagnosticStatus::STALE, "no frames yet");
+    else if (!dead.empty())
+        status.summaryf(diagnostic_msgs::DiagnosticStatus::ERROR,
+                        "dead lasers: %s", dead.c_str());
+    else if (!degraded.empty())
+        status.summaryf(diagnostic_msgs::DiagnosticStatus::WARN,
+                        "degraded lasers: %s", degraded.c_str());
+    else
+        status.summary(diagnostic_msgs::DiagnosticStatus::OK, "all lasers ok");
+    status.add("frames", frames);
+}
+
+void Convert::diagTimerCallback(const ros::TimerEvent &event)
+{
+    diagnostics_.update();
 }
 
 void Convert::processGps(const pandar_msgs::PandarGps::ConstPtr &gpsMsg)
 {
     hasGps = 1;
-    struct tm t;
-    t.tm_sec = gpsMsg->second;
-    t.tm_min = gpsMsg->minute;
-    t.tm_hour = gpsMsg->hour;
-    t.tm_mday = gpsMsg->day;
-    t.tm_mon = gpsMsg->month - 1;
-    t.tm_year = gpsMsg->year + 2000 - 1900;
-    t.tm_isdst = 0;
-    if(lastGPSSecond != (mktime(&t) + 1))
-    {
-        lastGPSSecond = (mktime(&t) + 1);
-        gps2.gps = mktime(&t) + 1; // the gps always is the last gps, the newest GPS data is after the PPS(Serial port transmition speed...)
-        gps2.used = 0;
-    }
-    // ROS_ERROR("Got data second : %f " ,(double)gps2.gps);
+    metrics_->gpsReceived();
+    pandar_rawdata::updateGps(*gpsMsg, gps2);
+    if (timeBase_ && lastPulse != 0.0)
+        timeBase_->addGps(gps2.gps, lastPulse);
+}
+
+/** @brief Diagnostic task, the time base shared by the sensors. */
+void Convert::reportTimeBase(diagnostic_updater::DiagnosticStatusWrapper &status)
+{
+    pandar_rawdata::time_base_stats_t stats = timeBase_->stats();
+    if (!stats.locked)
+        status.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                       "no GPS time yet");
+    else if (stats.relocks)
+        status.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                       "time base moved, check the GPS and system clock");
+    else
+        status.summary(diagnostic_msgs::DiagnosticStatus::OK, "locked");
+    status.addf("offset (s)", "%.6f", stats.offset);
+    status.addf("GPS times fused", "%llu", (unsigned long long) stats.accepted);
+    status.addf("GPS outliers", "%llu", (unsigned long long) stats.outliers);
+    status.addf("relocks", "%llu", (unsigned long long) stats.relocks);
 }
 
 } // namespace pandar_pointcloud
@@ -19,40 +19,120 @@
 #define _PANDAR_POINTCLOUD_CONVERT_H_ 1
 
 #include <ros/ros.h>
-#include <semaphore.h>
-#include <pthread.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/LaserScan.h>
 #include <pandar_pointcloud/rawdata.h>
 
 #include <dynamic_reconfigure/server.h>
 #include <pandar_pointcloud/CloudNodeConfig.h>
 #include <boost/lockfree/queue.hpp>
 #include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include "bounded_queue.h"
 #include "driver.h"
+#include "executor.h"
+#include "latency.h"
+#include "metrics.h"
 #include <pandar_msgs/PandarPacket.h>
+#include <pandar_msgs/PandarFrameInfo.h>
+#include <pandar_msgs/PandarShmFrame.h>
+#include <pandar_pointcloud/shm_ring.h>
 
 namespace pandar_pointcloud
 {
+/** a packet waiting for conversion, with its timing checkpoints */
+typedef struct {
+    pandar_msgs::PandarPacket packet;
+    double receive_time;             ///< wall clock, from the input
+    double enqueue_time;             ///< wall clock
+} QueuedPacket;
+
+/** a converted frame waiting to be published */
+typedef struct {
+    pandar_rawdata::PPointCloud::Ptr cloud;
+    pandar_msgs::PandarFrameInfoPtr info;
+    std::vector<pandar_rawdata::PPointCloud::Ptr> outputs;  ///< of outputPubs_
+    sensor_msgs::LaserScanPtr scan;  ///< of the scan rings, if any
+    pandar_rawdata::PPointCloud::Ptr edges;    ///< features, if picked
+    pandar_rawdata::PPointCloud::Ptr planars;
+    double first_receive;            ///< receive time of the first packet
+    double last_receive;             ///< receive time of the closing packet
+    double convert_end;              ///< wall clock
+} ConvertedFrame;
+
 class Convert
 {
 public:
 
     Convert(ros::NodeHandle node, ros::NodeHandle private_nh);
-    ~Convert() {}
+    ~Convert();
+
+    /** @brief Start reading the input, as the constructor does. */
+    void start();
+
+    /** @brief Stop reading and wait for the tasks of this sensor.
+     *
+     *  Returns within a packet of PCAP replay, or within the input
+     *  poll timeout for a socket read on a thread.  Queued packets and
+     *  frames are dropped, the buffers are kept for start().
+     */
+    void stop();
+
+    /** @brief Drop the packets received while paused, keeping the
+     *  input open; a replay stops reading instead.
+     */
+    void pause(bool paused);
+
+    /** @brief Switch to a PCAP file or, if pcap is empty, the socket
+     *  on port, without tearing the pipeline down.
+     */
+    void reopenInput(const std::string &pcap, int port);
 
     void DriverReadThread();
     void processGps(pandar_msgs::PandarGps &gpsMsg);
-    void pushLiDARData(pandar_msgs::PandarPacket packet);
+    void pushLiDARData(const pandar_msgs::PandarPacket &packet,
+                       double receive_time);
 
-    int processLiDARData();
+    /** @brief The rotation rate measured while converting, for the
+     *  driver thread.
+     *
+     *  @param changes the changes() of the rate last taken, updated
+     *  @returns true, and the new rate in @c rotation, when it changed
+     */
+    bool rotationChanged(int &changes, pandar_msgs::RotationRate &rotation);
 
 private:
 
     void callback(pandar_pointcloud::CloudNodeConfig &config,
                   uint32_t level);
+    void configureInput(const std::string &pcap);
     void processScan(const pandar_msgs::PandarScan::ConstPtr &scanMsg);
     void processGps(const pandar_msgs::PandarGps::ConstPtr &gpsMsg);
-
+    void diagTimerCallback(const ros::TimerEvent &event);
+    void processPacket(QueuedPacket &item, size_t depth);
+    void finishFrame(double firstStamp, double convertStart,
+                     double receiveTime);
+    void resizeQueue(int revolution);
+    void shareRotation();
+    void setupOutputs(ros::NodeHandle node, ros::NodeHandle private_nh);
+    void setupScan(ros::NodeHandle node, ros::NodeHandle private_nh);
+    void setupFeatures(ros::NodeHandle node, ros::NodeHandle private_nh);
+    bool listening();
+    void notifyReceive();
+    void receivePackets();
+    void taskPosted();
+    void taskDone();
+    void scheduleConvert();
+    void convertPackets();
+    void schedulePublish();
+    void publishFrames();
+    void publishFrame(const ConvertedFrame &frame);
+    void writeShm(const pandar_rawdata::PPointCloud &pc);
+    void reportLaserHealth(diagnostic_updater::DiagnosticStatusWrapper &status);
+    void reportTimeBase(diagnostic_updater::DiagnosticStatusWrapper &status);
 
 
     ///Pointer to dynamic reconfigure service srv_
@@ -63,6 +143,30 @@ private:
     ros::Subscriber pandar_scan_;
     ros::Subscriber pandar_gps_;
     ros::Publisher output_;
+    ros::Publisher frame_info_;
+
+    /** additional outputs filled in the same decoding pass: a ring
+        mask, azimuth crop, range gate and decimation each */
+    std::vector<ros::Publisher> outputPubs_;
+
+    /** planar scan of the scan rings, filled while decoding; no scan
+        when scanBins is 0 */
+    ros::Publisher scan_;
+    int scanBins;
+    double scanMinRange;
+    double scanMaxRange;
+
+    /** LOAM style edge and planar points, picked while decoding when
+        features is set */
+    ros::Publisher edges_;
+    ros::Publisher planars_;
+
+    /** shared memory ring the frames are also written to, if any */
+    boost::shared_ptr<ShmRingWriter> shm_;
+    ros::Publisher shm_frame_;
+
+    /** frames covering less of a revolution are not published */
+    double minCoverage;
 
     /// configuration parameters
     typedef struct {
@@ -74,14 +178,90 @@ private:
     pandar_rawdata::gps_struct_t gps2;
     bool hasGps;
 
-    unsigned int lastGPSSecond;
+    /** shared_time_base: the UTC second of packets is decided by the
+        time base of the process, fed the GPS packets of every sensor
+        with the stamp of the PPS pulse they follow */
+    pandar_rawdata::TimeBase *timeBase_;
+    boost::atomic<double> lastPulse;
+
     int lidarRotationStartAngle;
 
+    /** convert on the reading thread, PCAP input only; the
+        offline_sync and queue_policy parameters, applied to each
+        input by configureInput() */
+    bool offlineSync;
+    bool configuredOfflineSync;
+    std::string configuredQueuePolicy;
+
+    /** frame being accumulated, and the stamp of the previous one */
+    pandar_rawdata::PPointCloud::Ptr outMsg;
+    double lastTimestamp;
+
     pandar_pointcloud::PandarDriver drv;
 
-    pthread_mutex_t piclock;
-    sem_t picsem;
-    std::list<pandar_msgs::PandarPacket> LiDARDataSet;
+    /** the input being read, as in the pcap and port parameters */
+    std::string inputPcap;
+    int inputPort;
+
+    /** subscribe_packets: convert the PandarScan batches of a remote
+        pandar_driver, on the subscription thread, instead */
+    bool subscribePackets;
+    ros::NodeHandle node_;
+
+    /** lifecycle: start(), stop() and reopenInput() are serialized by
+        lifecycleMutex_; every task posted for this sensor is counted
+        in tasks_, so that stop() can wait for the last one */
+    boost::mutex lifecycleMutex_;
+    boost::atomic<bool> running;
+    boost::atomic<bool> paused;
+    bool watching;
+    boost::thread readThread_;
+    boost::mutex tasksMutex_;
+    boost::condition_variable tasksDone_;
+    int tasks_;
+
+    /** packets read but not yet converted; with drop_frame, the frame
+        being assembled is discarded once packets of it were dropped */
+    boost::shared_ptr<BoundedQueue<QueuedPacket> > packetQueue_;
+    bool dropFrame;
+    boost::atomic<bool> framePacketsDropped;
+
+    /** revolutions the packet queue holds, 0 when queue_size fixed
+        its capacity; packets in a revolution when it was sized */
+    static const int QUEUE_REVOLUTIONS = 5;
+    int queueRevolutions;
+    int revolutionPackets;
+
+    /** copy of the rotation rate of data_, shared with the driver */
+    boost::mutex rotationMutex_;
+    pandar_msgs::RotationRate sharedRotation_;
+    boost::atomic<int> rotationChanges;
+
+    /** frames converted but not yet published, so that slow
+        subscribers never hold up conversion; a replay publishes
+        on the conversion task instead, to lose no frame */
+    boost::shared_ptr<BoundedQueue<ConvertedFrame> > publishQueue_;
+    bool publishInline;
+
+    /** receive, conversion and publishing tasks of this sensor run on
+        the executor of the process; a stage is scheduled at most once */
+    Executor *executor_;
+    boost::shared_ptr<Strand> convertStrand_;
+    boost::shared_ptr<Strand> publishStrand_;
+    boost::atomic<bool> convertScheduled;
+    boost::atomic<bool> publishScheduled;
+
+    /** per stage latency, and the receive time of the packet that
+        started the frame being accumulated */
+    LatencyTracker latency_;
+    double frameFirstReceive;
+
+    /** pipeline health */
+    boost::shared_ptr<PipelineMetrics> metrics_;
+
+    /** diagnostics updater */
+    diagnostic_updater::Updater diagnostics_;
+    ros::Timer diag_timer_;
 };
 
 } // namespace pandar_pointcloud
@@ -31,6 +31,8 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
                                ros::NodeHandle private_nh ,  pandar_pointcloud::Convert *cvt)
 {
   convert = cvt;
+  filled_ = 0;
+  private_nh_ = private_nh;
   // use private node handle to get parameters
   private_nh.param("frame_id", config_.frame_id, std::string("pandar"));
   std::string tf_prefix = tf::getPrefixParam(private_nh);
@@ -41,6 +43,7 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
   config_.model = "Pandar40";
   std::string model_full_name = std::string("Hesai") + config_.model;
   double packet_rate = 3000;                   // packet frequency (Hz)
+  packet_rate_ = packet_rate;
   std::string deviceName(model_full_name);
 
   private_nh.param("rpm", config_.rpm, 600.0);
@@ -48,10 +51,29 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
   double frequency = (config_.rpm / 60.0);     // expected Hz rate
 
   // default number of packets for each scan is a single revolution
-  // (fractions rounded up)
+  // (fractions rounded up), and follows the rotation rate measured
+  // once the device is switched to another one, unless given
   config_.npackets = (int) ceil(packet_rate / frequency);
-  private_nh.getParam("npackets", config_.npackets);
+  config_.fixed_npackets = private_nh.getParam("npackets", config_.npackets);
   ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+  rotation_.reset(config_.rpm);
+  rotationChanges_ = 0;
+
+  // scan_per_revolution publishes each revolution, from the packet
+  // crossing start_angle, as one scan on pandar_packets instead
+  double start_angle;
+  private_nh.param("scan_per_revolution", config_.scan_per_revolution, false);
+  private_nh.param("start_angle", start_angle, 0.0);
+  config_.start_angle = int(start_angle * 100);
+  last_azimuth_ = -1;
+  if (config_.scan_per_revolution)
+    ROS_INFO("publishing a scan per revolution, starting at %.2f degrees",
+             start_angle);
+
+  // the scans held by subscribers, plus the one being filled
+  scan_pool_.reset(new ScanPool(4, 16, config_.scan_per_revolution ?
+                                config_.npackets + config_.npackets / 4 :
+                                config_.npackets / 3));
 
   std::string dump_file;
   private_nh.param("pcap", dump_file, std::string(""));
@@ -67,32 +89,31 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
   // f = boost::bind (&PandarDriver::callback, this, _1, _2);
   // srv_->setCallback (f); // Set callback function und call initially
 
+  // the packets may be received from a pandar_driver on another host,
+  // which opens the input, publishes pandar_packets and monitors it
+  bool subscribe;
+  private_nh.param("subscribe_packets", subscribe, false);
+  if (subscribe)
+    return;
+
   // initialize diagnostics
   diagnostics_.setHardwareID(deviceName);
-  const double diag_freq = packet_rate/config_.npackets;
+  // poll() publishes a third of npackets at a time, or a revolution
+  const double diag_freq = config_.scan_per_revolution ?
+    frequency : packet_rate/(config_.npackets / 3);
   diag_max_freq_ = diag_freq;
   diag_min_freq_ = diag_freq;
   ROS_INFO("expected frequency: %.3f (Hz)", diag_freq);
 
-  // using namespace diagnostic_updater;
-  // diag_topic_.reset(new TopicDiagnostic("pandar_packets", diagnostics_,
-  //                                       FrequencyStatusParam(&diag_min_freq_,
-  //                                                            &diag_max_freq_,
-  //                                                            0.1, 10),
-  //                                       TimeStampStatusParam()));
+  using namespace diagnostic_updater;
+  diag_topic_.reset(new TopicDiagnostic("pandar_packets", diagnostics_,
+                                        FrequencyStatusParam(&diag_min_freq_,
+                                                             &diag_max_freq_,
+                                                             0.1, 10),
+                                        TimeStampStatusParam()));
 
   // open Pandar input device or file
-  if (dump_file != "")                  // have PCAP file?
-    {
-      // read data from packet capture file
-      input_.reset(new pandar_pointcloud::InputPCAP(private_nh, udp_port,
-                                                  packet_rate, dump_file));
-    }
-  else
-    {
-      // read data from live socket
-      input_.reset(new pandar_pointcloud::InputSocket(private_nh, udp_port));
-    }
+  openInput(dump_file, udp_port);
 
   // raw packet output topic
   output_ =
@@ -102,136 +123,197 @@ PandarDriver::PandarDriver(ros::NodeHandle node,
     node.advertise<pandar_msgs::PandarGps>("pandar_gps", 1);
 }
 
-#define HS_LIDAR_L40_GPS_PACKET_SIZE (512)
-#define HS_LIDAR_L40_GPS_PACKET_FLAG_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_YEAR_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_MONTH_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_DAY_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_HOUR_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_MINUTE_SIZE (2)
-#define HS_LIDAR_L40_GPS_PACKET_SECOND_SIZE (2)
-#define HS_LIDAR_L40_GPS_ITEM_NUM (7)
-
-//--------------------------------------
-typedef struct HS_LIDAR_L40_GPS_PACKET_s{
-    unsigned short flag;
-    unsigned short year;
-    unsigned short month;
-    unsigned short day;
-    unsigned short second;
-    unsigned short minute;
-    unsigned short hour;
-    unsigned int fineTime;
-//    unsigned char unused[496];
-}HS_LIDAR_L40_GPS_Packet;
-
-//-------------------------------------------------------------------------------
-int HS_L40_GPS_Parse(HS_LIDAR_L40_GPS_Packet *packet , const unsigned char* recvbuf , const int len)
+/** open the Pandar input device or file, closing the previous one
+ *
+ *  The partial scan is discarded, its packets came from the old input.
+ */
+void PandarDriver::openInput(const std::string &pcap, int port)
 {
-    if(len != HS_LIDAR_L40_GPS_PACKET_SIZE)
-        return -1;
-
-    int index = 0;
-    packet->flag = (recvbuf[index] & 0xff)|((recvbuf[index + 1] & 0xff)<< 8);
-    index += HS_LIDAR_L40_GPS_PACKET_FLAG_SIZE;
-    packet->year = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10;
-    index += HS_LIDAR_L40_GPS_PACKET_YEAR_SIZE;
-    packet->month = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10;
-    index += HS_LIDAR_L40_GPS_PACKET_MONTH_SIZE;
-    packet->day = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10;
-    index += HS_LIDAR_L40_GPS_PACKET_DAY_SIZE;
-    packet->second = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10;
-    index += HS_LIDAR_L40_GPS_PACKET_SECOND_SIZE;
-    packet->minute = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10;
-    index += HS_LIDAR_L40_GPS_PACKET_MINUTE_SIZE;
-    packet->hour = (recvbuf[index] & 0xff - 0x30) + (recvbuf[index + 1] & 0xff - 0x30) * 10 + 8;
-    index += HS_LIDAR_L40_GPS_PACKET_HOUR_SIZE;
-    packet->fineTime = (recvbuf[index]& 0xff)| (recvbuf[index + 1]& 0xff) << 8 |
-                       ((recvbuf[index + 2 ]& 0xff) << 16) | ((recvbuf[index + 3]& 0xff) << 24);
-    return 0;
+  // close first: the new socket may bind the same port
+  input_.reset();
+  scan_.reset();
+  filled_ = 0;
+  last_azimuth_ = -1;
+  if (pcap != "")                       // have PCAP file?
+    {
+      // read data from packet capture file
+      input_.reset(new pandar_pointcloud::InputPCAP(private_nh_, port,
+                                                  packet_rate_, pcap));
+    }
+  else
+    {
+      // read data from live socket
+      input_.reset(new pandar_pointcloud::InputSocket(private_nh_, port));
+    }
 }
 
-/** poll the device
+/** read one packet into the scan being filled, publishing the scan
+ *  once it is full
  *
- *  @returns true unless end of file reached
+ *  With scan_per_revolution the scan is full at the packet in which
+ *  the rotation crosses start_angle, and that packet opens the next
+ *  one: a scan holds no block of the following revolution.
+ *
+ *  @returns 0 if a packet was read, 2 if it completed a scan, 1 if
+ *           none came, -1 at end of file
  */
-bool PandarDriver::poll(void)
+int PandarDriver::readPacket(void)
 {
   int readpacket = config_.npackets / 3;
-  // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-  pandar_msgs::PandarScanPtr scan(new pandar_msgs::PandarScan);
-  scan->packets.resize(readpacket);
-
-  // Since the pandar delivers data at a very high rate, keep
-  // reading and publishing scans as fast as possible.
-  for (int i = 0; i < readpacket; ++i)
+  if (!scan_)
     {
-      while (true)
-        {
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i], config_.time_offset);
-          if (rc == 0) break;       // got a full packet?
-          if (rc == 2)
-          {
-            // gps packet;
-            HS_LIDAR_L40_GPS_Packet packet;
-            if(HS_L40_GPS_Parse( &packet , &scan->packets[i].data[0] , HS_LIDAR_L40_GPS_PACKET_SIZE) == 0)
-            {
-              pandar_msgs::PandarGpsPtr gps(new pandar_msgs::PandarGps);
-              gps->stamp = ros::Time::now();
-
-              gps->year = packet.year;
-              gps->month = packet.month;
-              gps->day = packet.day;
-              gps->hour = packet.hour;
-              gps->minute = packet.minute;
-              gps->second = packet.second;
-
-              gps->used = 0;
-              if(gps->year > 30 || gps->year < 17)
-              {
-                ROS_ERROR("Ignore wrong GPS data (year)%d" , gps->year);
-                continue;
-              }
-              convert->processGps(*gps);
-              gpsoutput_.publish(gps);
-            }
-            
-          }
-          if (rc < 0) return false; // end of file reached?
-        }
-
-        convert->pushLiDARData(scan->packets[i]);
+      // a shared pointer for zero-copy sharing with other nodelets,
+      // recycled once they all released it
+      scan_ = scan_pool_->get();
+      if (!config_.scan_per_revolution)
+        scan_->packets.resize(readpacket);
+      filled_ = 0;
     }
+  if (filled_ == (int) scan_->packets.size())
+    scan_->packets.resize(filled_ + 1);
+
+  pandar_msgs::PandarPacket &packet = scan_->packets[filled_];
+  int rc = input_->getPacket(&packet, config_.time_offset);
+  if (rc == 2)
+  {
+    // gps packet;
+    pandar_msgs::PandarGpsPtr gps(new pandar_msgs::PandarGps);
+    if(pandar_rawdata::parseGpsPacket(*gps, &packet.data[0],
+                                      pandar_rawdata::GPS_PACKET_SIZE) == 0)
+    {
+      gps->stamp = ros::Time::now();
+      if(gps->year > 30 || gps->year < 17)
+      {
+        ROS_ERROR("Ignore wrong GPS data (year)%d" , gps->year);
+        return 0;
+      }
+      convert->processGps(*gps);
+      gpsoutput_.publish(gps);
+    }
+    return 0;
+  }
+  if (rc < 0) return -1;          // end of file reached?
+  if (rc != 0) return 1;
 
-  // publish message using time of last packet read
-  ROS_DEBUG("Publishing a full Pandar scan.");
-  scan->header.stamp = scan->packets[readpacket - 1].stamp;
-  scan->header.frame_id = config_.frame_id;
-  output_.publish(scan);
-
-
-
-
-
-
-
-
+  // RawData measures the rotation rate of the packets it converts
+  if (convert->rotationChanged(rotationChanges_, rotation_))
+    followRotationRate();
 
+  convert->pushLiDARData(packet, input_->receiveTime());
 
+  if (config_.scan_per_revolution)
+    {
+      if (pandar_msgs::crossesStartAngle(last_azimuth_, packet,
+                                         config_.start_angle)
+          && filled_ > 0)
+        {
+          pandar_msgs::PandarScanPtr next = scan_pool_->get();
+          if (next->packets.empty())
+            next->packets.resize(1);
+          next->packets[0] = packet;
+          scan_->packets.resize(filled_);
+          publishScan();
+          scan_ = next;
+          filled_ = 1;
+          return 2;
+        }
+      // a revolution that never ends: the device stopped rotating
+      if (++filled_ < 2 * config_.npackets)
+        return 0;
+      ROS_WARN_THROTTLE(10, "no revolution start in %d packets", filled_);
+      scan_->packets.resize(filled_);
+    }
+  else if (++filled_ < readpacket)
+    return 0;
 
+  publishScan();
+  scan_.reset();
+  return 2;
+}
 
+/** resize what depends on the rotation rate, once a new one was
+ *  measured
+ *
+ *  npackets and the packets reserved in scans follow the packets per
+ *  revolution, unless npackets was given.  A scan being filled is
+ *  published at the new size.
+ */
+void PandarDriver::followRotationRate(void)
+{
+  config_.rpm = rotation_.rpm();
+  int revolution = rotation_.packetsPerRevolution();
+  ROS_INFO("rotating at %.0f RPM (measured %.1f), %d packets per revolution",
+           config_.rpm, rotation_.measuredRpm(), revolution);
+  if (!config_.fixed_npackets)
+    {
+      config_.npackets = revolution;
+      scan_pool_->setPackets(config_.scan_per_revolution ?
+                             config_.npackets + config_.npackets / 4 :
+                             config_.npackets / 3);
+      ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
+    }
 
+  // the packet rate doubles with dual return, the revolutions do not
+  double frequency = config_.rpm / 60.0;
+  const double diag_freq = config_.scan_per_revolution ?
+    frequency : frequency * revolution / (config_.npackets / 3);
+  diag_max_freq_ = diag_freq;
+  diag_min_freq_ = diag_freq;
+}
 
+void PandarDriver::publishScan(void)
+{
+  // publish message using time of last packet read
+  ROS_DEBUG("Publishing a full Pandar scan.");
+  scan_->header.stamp = scan_->packets.back().stamp;
+  scan_->header.frame_id = config_.frame_id;
+  output_.publish(scan_);
 
   // notify diagnostics that a message has been published, updating
   // its status
-  // diag_topic_->tick(scan->header.stamp);
-  // diagnostics_.update();
+  diag_topic_->tick(scan_->header.stamp);
+  diagnostics_.update();
+}
 
+/** poll the device, until a scan is published or nothing came
+ *
+ *  @returns true unless end of file reached
+ */
+bool PandarDriver::poll(void)
+{
+  // Since the pandar delivers data at a very high rate, keep
+  // reading and publishing scans as fast as possible.
+  int rc;
+  do
+    {
+      rc = readPacket();
+      if (rc < 0)
+        return false;
+    }
+  while (rc == 0);
   return true;
 }
 
+/** read the packets already received, without waiting for more
+ *
+ *  @returns packets read, at most max; -1 at end of file
+ */
+int PandarDriver::readAvailable(int max)
+{
+  input_->setPollTimeout(0);
+  int n = 0;
+  while (n < max)
+    {
+      int rc = readPacket();
+      if (rc < 0)
+        return -1;
+      if (rc == 1)
+        break;
+      ++n;
+    }
+  return n;
+}
+
 void PandarDriver::callback(pandar_pointcloud::CloudNodeConfig &config,
               uint32_t level)
 {
@@ -23,12 +23,16 @@
 #include <dynamic_reconfigure/server.h>
 
 #include <pandar_pointcloud/input.h>
+#include <pandar_msgs/rotation_rate.h>
 #include <pandar_pointcloud/CloudNodeConfig.h>
+#include <pandar_msgs/scan_pool.h>
 
 
 
 namespace pandar_pointcloud
 {
+using pandar_msgs::ScanPool;
+
 class Convert;
 
 class PandarDriver
@@ -40,9 +44,21 @@ public:
   ~PandarDriver() {}
 
   bool poll(void);
+  int readAvailable(int max);
+
+  /** replace the input by a PCAP file or, if pcap is empty, the
+   *  socket on port; the pipeline must be stopped */
+  void openInput(const std::string &pcap, int port);
+
+  /** socket to watch for packets, -1 for PCAP input */
+  int fd() const { return input_ ? input_->fd() : -1; }
 
 private:
 
+  int readPacket(void);
+  void followRotationRate(void);
+  void publishScan(void);
+
   ///Callback for dynamic reconfigure
   void callback(pandar_pointcloud::CloudNodeConfig &config,
               uint32_t level);
@@ -57,11 +73,16 @@ private:
     std::string frame_id;            ///< tf frame ID
     std::string model;               ///< device model name
     int    npackets;                 ///< number of packets to collect
+    bool   fixed_npackets;           ///< npackets given, not measured
     double rpm;                      ///< device rotation rate (RPMs)
     double time_offset;              ///< time in seconds added to each pandar time stamp
+    bool scan_per_revolution;        ///< cut scans where a revolution starts
+    int start_angle;                 ///< where it starts, 1/100 degree
   } config_;
 
   boost::shared_ptr<Input> input_;
+  ros::NodeHandle private_nh_;       ///< for the input parameters
+  double packet_rate_;               ///< packet frequency (Hz)
   ros::Publisher output_;
   ros::Publisher gpsoutput_;
 
@@ -72,6 +93,20 @@ private:
   boost::shared_ptr<diagnostic_updater::TopicDiagnostic> diag_topic_;
 
   pandar_pointcloud::Convert * convert;
+
+  /** scan being filled, and the packets in it; scans come from a pool
+      so that the receive loop does not allocate */
+  boost::shared_ptr<ScanPool> scan_pool_;
+  pandar_msgs::PandarScanPtr scan_;
+  int filled_;
+
+  /** azimuth of the last block read, with scan_per_revolution */
+  int last_azimuth_;
+
+  /** rotation rate the converter measured, npackets follows it, and
+      the changes() it was taken at */
+  pandar_msgs::RotationRate rotation_;
+  int rotationChanges_;
 };
 
 } // namespace pandar_driver
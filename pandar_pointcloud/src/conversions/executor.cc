@@ -0,0 +1,254 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Worker threads shared by every Pandar40 in a process.
+
+*/
+
+#include "executor.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <ros/ros.h>
+
+namespace pandar_pointcloud
+{
+/** tasks a strand runs before letting other work in */
+static const int STRAND_BATCH = 4;
+
+/** @brief Parse a list of cores such as "0-3,6".
+ *  @returns false if it is malformed
+ */
+static bool parseCpus(const std::string &list, std::vector<int> &cpus)
+{
+    cpus.clear();
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+                return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            cpus.push_back(cpu);
+        if (*p == ',')
+            ++p;
+        else if (*p)
+            return false;
+    }
+    return true;
+}
+
+Executor &Executor::instance(int threads, const std::string &affinity)
+{
+    static boost::mutex lock;
+    // never destroyed: its threads run until the process exits
+    static Executor *executor = NULL;
+
+    boost::mutex::scoped_lock guard(lock);
+    if (executor == NULL)
+    {
+        std::vector<int> cpus;
+        if (!parseCpus(affinity, cpus))
+        {
+            ROS_WARN_STREAM("bad executor_affinity " << affinity
+                            << ", ignored");
+            cpus.clear();
+        }
+        if (threads <= 0)
+            threads = cpus.empty() ? boost::thread::hardware_concurrency()
+                                   : cpus.size();
+        executor = new Executor(std::max(threads, 1), cpus);
+        executor->affinity_ = affinity;
+        ROS_INFO("executor: %zu threads%s%s", executor->threads(),
+                 affinity.empty() ? "" : " on cores ", affinity.c_str());
+    }
+    else if ((threads > 0 && (size_t) threads != executor->threads())
+             || affinity != executor->affinity_)
+    {
+        ROS_WARN("executor already running with %zu threads, the"
+                 " executor_threads and executor_affinity of the first"
+                 " sensor apply", executor->threads());
+    }
+    return *executor;
+}
+
+Executor::Executor(int threads, const std::vector<int> &cpus):
+    cpus_(cpus)
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+        ROS_ERROR("epoll_create1() failed: %s", strerror(errno));
+
+    for (int i = 0; i < threads; ++i)
+        workers_.push_back(new boost::thread(boost::bind(&Executor::worker,
+                                                         this)));
+    reactor_ = boost::thread(boost::bind(&Executor::reactor, this));
+}
+
+Executor::~Executor()
+{
+    // not reached, see instance()
+}
+
+void Executor::setAffinity()
+{
+    if (cpus_.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus_.size(); ++i)
+        CPU_SET(cpus_[i], &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+        ROS_WARN("cannot set executor thread affinity: %s", strerror(rc));
+}
+
+void Executor::post(const Task &task)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    tasks_.push_back(task);
+    ready_.notify_one();
+}
+
+void Executor::worker()
+{
+    setAffinity();
+    while (true)
+    {
+        Task task;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while (tasks_.empty())
+                ready_.wait(lock);
+            task.swap(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+int Executor::watch(int fd, const Task &notify)
+{
+    {
+        boost::mutex::scoped_lock lock(watch_mutex_);
+        watched_[fd] = notify;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        int err = errno;
+        boost::mutex::scoped_lock lock(watch_mutex_);
+        watched_.erase(fd);
+        return err;
+    }
+    return 0;
+}
+
+void Executor::rearm(int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    // ENOENT: unwatched meanwhile
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) != 0 && errno != ENOENT)
+        ROS_ERROR("cannot watch fd %d again: %s", fd, strerror(errno));
+}
+
+void Executor::unwatch(int fd)
+{
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+    boost::mutex::scoped_lock lock(watch_mutex_);
+    watched_.erase(fd);
+}
+
+void Executor::reactor()
+{
+    setAffinity();
+    static const int MAX_EVENTS = 16;
+    struct epoll_event events[MAX_EVENTS];
+    while (epoll_fd_ >= 0)
+    {
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno != EINTR)
+            {
+                ROS_ERROR("epoll_wait() failed: %s", strerror(errno));
+                usleep(100000);
+            }
+            continue;
+        }
+        // notify under the lock, so that unwatch() waits for it
+        boost::mutex::scoped_lock lock(watch_mutex_);
+        for (int i = 0; i < n; ++i)
+        {
+            std::map<int, Task>::iterator it =
+                watched_.find(events[i].data.fd);
+            if (it != watched_.end())
+                it->second();
+        }
+    }
+}
+
+void Strand::post(const Executor::Task &task)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    tasks_.push_back(task);
+    if (scheduled_)
+        return;
+    scheduled_ = true;
+    executor_.post(boost::bind(&Strand::run, shared_from_this()));
+}
+
+void Strand::run()
+{
+    for (int i = 0; i < STRAND_BATCH; ++i)
+    {
+        Executor::Task task;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (tasks_.empty())
+            {
+                scheduled_ = false;
+                return;
+            }
+            task.swap(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+
+    // more to do: back to the end of the queue
+    boost::mutex::scoped_lock lock(mutex_);
+    if (tasks_.empty())
+        scheduled_ = false;
+    else
+        executor_.post(boost::bind(&Strand::run, shared_from_this()));
+}
+
+} // namespace pandar_pointcloud
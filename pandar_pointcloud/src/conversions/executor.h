@@ -0,0 +1,127 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Worker threads shared by every Pandar40 in a process.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_EXECUTOR_H_
+#define _PANDAR_POINTCLOUD_EXECUTOR_H_ 1
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace pandar_pointcloud
+{
+/** @brief Process wide pool of worker threads.
+ *
+ *  Every sensor of a nodelet manager runs its receive, conversion and
+ *  publishing work as short tasks here, so the number of threads
+ *  follows executor_threads rather than the number of sensors.  Tasks
+ *  go into one ready queue, and whichever worker is idle takes the
+ *  next one, whatever sensor it belongs to.
+ *
+ *  Sockets are watched by one more thread with epoll: when a watched
+ *  socket becomes readable its notify function is called there, to
+ *  post the work that reads it, and the socket is not watched again
+ *  until that work calls rearm().
+ */
+class Executor
+{
+public:
+
+    typedef boost::function<void()> Task;
+
+    /** @brief The executor of this process, started by the first call.
+     *
+     *  @param threads workers, 0 for one per core
+     *  @param affinity cores the threads may run on, such as "0-3,6";
+     *         empty to leave them to the scheduler
+     */
+    static Executor &instance(int threads, const std::string &affinity);
+
+    void post(const Task &task);
+
+    /** @brief Call @c notify, from the watching thread, every time @c fd
+     *  becomes readable; it should only post work.
+     *  @returns 0 if successful, errno value for failure
+     */
+    int watch(int fd, const Task &notify);
+
+    /** @brief Watch @c fd again, once its work has read what it could. */
+    void rearm(int fd);
+
+    /** @brief Stop watching @c fd; once this returns, its notify
+     *  function is not running and will not be called again.
+     */
+    void unwatch(int fd);
+
+    size_t threads() const { return workers_.size(); }
+
+private:
+
+    Executor(int threads, const std::vector<int> &cpus);
+    ~Executor();
+
+    void worker();
+    void reactor();
+    void setAffinity();
+
+    std::vector<int> cpus_;
+    std::string affinity_;
+
+    boost::mutex mutex_;
+    boost::condition_variable ready_;
+    std::deque<Task> tasks_;
+
+    int epoll_fd_;
+    boost::mutex watch_mutex_;
+    std::map<int, Task> watched_;
+
+    std::vector<boost::thread *> workers_;
+    boost::thread reactor_;
+};
+
+/** @brief Runs its tasks one at a time and in order, on the executor.
+ *
+ *  A strand with work is queued on the executor like a task, and runs
+ *  a few of its tasks per turn before going back to the end of the
+ *  queue, so a busy sensor does not hold a worker for long.
+ */
+class Strand: public boost::enable_shared_from_this<Strand>
+{
+public:
+
+    Strand(Executor &executor):
+        executor_(executor), scheduled_(false)
+    {}
+
+    void post(const Executor::Task &task);
+
+private:
+
+    void run();
+
+    Executor &executor_;
+    boost::mutex mutex_;
+    std::deque<Executor::Task> tasks_;
+    bool scheduled_;
+};
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_EXECUTOR_H_
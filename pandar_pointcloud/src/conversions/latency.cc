@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Per stage latency histograms of the Pandar40 cloud pipeline.
+
+*/
+
+#include "latency.h"
+
+#include <stdio.h>
+
+namespace pandar_pointcloud
+{
+
+LatencyHistogram::LatencyHistogram():
+    total_usec_(0), max_usec_(0)
+{
+    for (int i = 0; i < BUCKETS; ++i)
+        buckets_[i].store(0, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::add(double seconds)
+{
+    uint64_t usec = (uint64_t) (seconds * 1e6);
+
+    // bucket i holds [2^i, 2^(i+1)) microseconds
+    int bucket = 0;
+    for (uint64_t v = usec; v > 1 && bucket < BUCKETS - 1; v >>= 1)
+        ++bucket;
+
+    buckets_[bucket].fetch_add(1, boost::memory_order_relaxed);
+    total_usec_.fetch_add(usec, boost::memory_order_relaxed);
+    uint64_t max = max_usec_.load(boost::memory_order_relaxed);
+    while (usec > max &&
+           !max_usec_.compare_exchange_weak(max, usec,
+                                            boost::memory_order_relaxed))
+        ;
+}
+
+LatencyHistogram::Summary LatencyHistogram::snapshot()
+{
+    uint64_t counts[BUCKETS];
+    Summary s;
+    s.count = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        counts[i] = buckets_[i].exchange(0, boost::memory_order_relaxed);
+        s.count += counts[i];
+    }
+    uint64_t total = total_usec_.exchange(0, boost::memory_order_relaxed);
+    s.max = max_usec_.exchange(0, boost::memory_order_relaxed) * 1e-6;
+    s.mean = s.count ? total * 1e-6 / s.count : 0.0;
+
+    double *percentiles[3] = {&s.p50, &s.p90, &s.p99};
+    const double fractions[3] = {0.50, 0.90, 0.99};
+    for (int p = 0; p < 3; ++p)
+    {
+        *percentiles[p] = 0.0;
+        if (s.count == 0)
+            continue;
+        uint64_t target = (uint64_t) (fractions[p] * s.count + 0.5);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts[i];
+            if (seen >= target && seen > 0)
+            {
+                *percentiles[p] = (2ULL << i) * 1e-6;
+                break;
+            }
+        }
+        // the bucket bound may exceed the largest latency seen
+        if (*percentiles[p] > s.max)
+            *percentiles[p] = s.max;
+    }
+    return s;
+}
+
+void LatencyTracker::report(diagnostic_updater::DiagnosticStatusWrapper &status)
+{
+    static const char *names[STAGE_COUNT] = {
+        "receive", "queue", "convert", "publish", "end to end", "frame"
+    };
+
+    status.summary(diagnostic_msgs::DiagnosticStatus::OK, "latency (ms)");
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        LatencyHistogram::Summary s = stages_[i].snapshot();
+        char value[128];
+        snprintf(value, sizeof(value),
+                 "n=%llu mean=%.3f p50=%.3f p90=%.3f p99=%.3f max=%.3f",
+                 (unsigned long long) s.count, s.mean * 1e3, s.p50 * 1e3,
+                 s.p90 * 1e3, s.p99 * 1e3, s.max * 1e3);
+        status.add(names[i], std::string(value));
+    }
+}
+
+} // namespace pandar_pointcloud
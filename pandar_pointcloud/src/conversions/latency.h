@@ -0,0 +1,95 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Per stage latency histograms of the Pandar40 cloud pipeline,
+    reported as diagnostics.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_LATENCY_H_
+#define _PANDAR_POINTCLOUD_LATENCY_H_ 1
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+namespace pandar_pointcloud
+{
+/** @brief Histogram of latencies, with power of two buckets from one
+ *  microsecond to several seconds.
+ *
+ *  add() may be called from one thread while another one takes a
+ *  snapshot; counts are kept with relaxed atomics.
+ */
+class LatencyHistogram
+{
+public:
+
+    LatencyHistogram();
+
+    /** @brief Record one latency, in seconds. */
+    void add(double seconds);
+
+    /** summary of the latencies recorded since the last snapshot */
+    typedef struct {
+        uint64_t count;
+        double mean;                 ///< seconds
+        double p50;                  ///< upper bucket bounds, seconds
+        double p90;
+        double p99;
+        double max;
+    } Summary;
+
+    /** @brief Summarize and clear the histogram. */
+    Summary snapshot();
+
+private:
+
+    static const int BUCKETS = 24;
+
+    boost::atomic<uint64_t> buckets_[BUCKETS];
+    boost::atomic<uint64_t> total_usec_;
+    boost::atomic<uint64_t> max_usec_;
+};
+
+/** @brief Latency of each pipeline stage, from the kernel receiving a
+ *  packet to the publication of the frame it closed.
+ */
+class LatencyTracker
+{
+public:
+
+    enum Stage {
+        RECEIVE,            ///< kernel receive to enqueue
+        QUEUE,              ///< enqueue to dequeue by the converter
+        CONVERT,            ///< dequeue to end of frame conversion
+        PUBLISH,            ///< end of conversion to end of publish()
+        END_TO_END,         ///< kernel receive of the last packet to publish
+        FRAME,              ///< kernel receive of the first packet to publish
+        STAGE_COUNT
+    };
+
+    void add(Stage stage, double seconds)
+    {
+        if (seconds >= 0.0)
+            stages_[stage].add(seconds);
+    }
+
+    /** @brief Diagnostic task, summarizes and clears every stage. */
+    void report(diagnostic_updater::DiagnosticStatusWrapper &status);
+
+private:
+
+    LatencyHistogram stages_[STAGE_COUNT];
+};
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_LATENCY_H_
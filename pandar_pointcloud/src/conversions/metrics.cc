@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Health metrics of the Pandar40 cloud pipeline.
+
+*/
+
+#include "metrics.h"
+
+#include <math.h>
+
+namespace pandar_pointcloud
+{
+
+PipelineMetrics::PipelineMetrics(double packet_rate):
+    packet_rate_(packet_rate),
+    packets_(0), gps_packets_(0), lost_(0), dropped_(0), frames_(0),
+    points_(0), coverage_ppm_(0), suppressed_(0), frames_dropped_(0),
+    last_gps_nsec_(0), queue_depth_(0),
+    queue_max_(0), gps_stamped_(false),
+    last_usec_(0), have_usec_(false),
+    last_report_(ros::WallTime::now().toSec()),
+    last_packets_(0), last_gps_packets_(0), last_lost_(0),
+    last_dropped_(0), last_frames_(0), last_points_(0),
+    last_coverage_ppm_(0), last_suppressed_(0), last_frames_dropped_(0)
+{
+}
+
+void PipelineMetrics::packetTimestamp(uint32_t usec)
+{
+    if (have_usec_)
+    {
+        // the device counter restarts on every PPS
+        int64_t delta = (int64_t) usec - last_usec_;
+        if (delta < 0)
+            delta += 1000000;
+        double period =
+            1e6 / packet_rate_.load(boost::memory_order_relaxed);
+        if (delta > 1.5 * period && delta < 500000)
+            lost_.fetch_add((uint64_t) lrint(delta / period) - 1,
+                            boost::memory_order_relaxed);
+    }
+    last_usec_ = usec;
+    have_usec_ = true;
+}
+
+void PipelineMetrics::frame(size_t points, double coverage, bool gps_stamped,
+                            bool published)
+{
+    frames_.fetch_add(1, boost::memory_order_relaxed);
+    points_.fetch_add(points, boost::memory_order_relaxed);
+    coverage_ppm_.fetch_add((uint64_t) (coverage * 1e6),
+                            boost::memory_order_relaxed);
+    if (!published)
+        suppressed_.fetch_add(1, boost::memory_order_relaxed);
+    gps_stamped_.store(gps_stamped, boost::memory_order_relaxed);
+}
+
+void PipelineMetrics::report(diagnostic_updater::DiagnosticStatusWrapper &status)
+{
+    double now = ros::WallTime::now().toSec();
+    double elapsed = now - last_report_;
+    if (elapsed <= 0.0)
+        elapsed = 1.0;
+    last_report_ = now;
+
+    uint64_t packets = packets_.load(boost::memory_order_relaxed);
+    uint64_t gps_packets = gps_packets_.load(boost::memory_order_relaxed);
+    uint64_t lost = lost_.load(boost::memory_order_relaxed);
+    uint64_t dropped = dropped_.load(boost::memory_order_relaxed);
+    uint64_t frames = frames_.load(boost::memory_order_relaxed);
+    uint64_t points = points_.load(boost::memory_order_relaxed);
+    uint64_t coverage_ppm = coverage_ppm_.load(boost::memory_order_relaxed);
+    uint64_t suppressed = suppressed_.load(boost::memory_order_relaxed);
+    uint64_t frames_dropped = frames_dropped_.load(boost::memory_order_relaxed);
+
+    double packet_rate = (packets - last_packets_) / elapsed;
+    double expected_rate = packet_rate_.load(boost::memory_order_relaxed);
+    double gps_rate = (gps_packets - last_gps_packets_) / elapsed;
+    uint64_t new_frames = frames - last_frames_;
+    double points_per_frame = new_frames ?
+        double(points - last_points_) / new_frames : 0.0;
+    double completeness = new_frames ?
+        (coverage_ppm - last_coverage_ppm_) * 1e-6 / new_frames : 0.0;
+    uint64_t new_suppressed = suppressed - last_suppressed_;
+    uint64_t new_lost = lost - last_lost_;
+    uint64_t new_dropped = dropped - last_dropped_;
+    uint64_t new_frames_dropped = frames_dropped - last_frames_dropped_;
+
+    last_packets_ = packets;
+    last_gps_packets_ = gps_packets;
+    last_lost_ = lost;
+    last_dropped_ = dropped;
+    last_frames_ = frames;
+    last_points_ = points;
+    last_coverage_ppm_ = coverage_ppm;
+    last_suppressed_ = suppressed;
+    last_frames_dropped_ = frames_dropped;
+
+    uint64_t last_gps = last_gps_nsec_.load(boost::memory_order_relaxed);
+    double gps_age = last_gps ? now - last_gps * 1e-9 : -1.0;
+    bool gps_stamped = gps_stamped_.load(boost::memory_order_relaxed);
+    const char *time_base;
+    if (gps_age < 0.0)
+        time_base = "no GPS";
+    else if (gps_age > 2.0)
+        time_base = "GPS lost";
+    else if (gps_stamped)
+        time_base = "GPS";
+    else
+        time_base = "GPS received, stamps use system time";
+
+    if (packet_rate == 0.0)
+        status.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
+                       "no packets received");
+    else if (new_lost || new_dropped || packet_rate < 0.9 * expected_rate)
+        status.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                       "packets lost or dropped");
+    else if (new_frames_dropped)
+        status.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                       "publishing falls behind");
+    else if (gps_age < 0.0 || gps_age > 2.0)
+        status.summary(diagnostic_msgs::DiagnosticStatus::WARN, time_base);
+    else
+        status.summary(diagnostic_msgs::DiagnosticStatus::OK, "ok");
+
+    status.addf("packet rate (Hz)", "%.1f", packet_rate);
+    status.addf("GPS packet rate (Hz)", "%.2f", gps_rate);
+    status.addf("frame rate (Hz)", "%.2f", new_frames / elapsed);
+    status.addf("points per frame", "%.0f", points_per_frame);
+    status.addf("queue depth", "%zu",
+                queue_depth_.load(boost::memory_order_relaxed));
+    status.addf("max queue depth", "%zu",
+                queue_max_.exchange(0, boost::memory_order_relaxed));
+    status.addf("packets lost", "%llu", (unsigned long long) new_lost);
+    status.addf("packets dropped", "%llu", (unsigned long long) new_dropped);
+    status.addf("frame completeness", "%.3f", completeness);
+    status.addf("frames suppressed", "%llu",
+                (unsigned long long) new_suppressed);
+    status.addf("frames dropped", "%llu",
+                (unsigned long long) new_frames_dropped);
+    status.add("time base", std::string(time_base));
+    if (gps_age >= 0.0)
+        status.addf("GPS age (s)", "%.1f", gps_age);
+}
+
+} // namespace pandar_pointcloud
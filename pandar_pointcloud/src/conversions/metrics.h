@@ -0,0 +1,131 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Health metrics of the Pandar40 cloud pipeline, reported as
+    diagnostics.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_METRICS_H_
+#define _PANDAR_POINTCLOUD_METRICS_H_ 1
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+namespace pandar_pointcloud
+{
+/** @brief Counters updated on the hot path with relaxed atomics, and
+ *  turned into rates once a second by report().
+ */
+class PipelineMetrics
+{
+public:
+
+    /** @param packet_rate expected data packets per second */
+    PipelineMetrics(double packet_rate);
+
+    void packetReceived()
+    {
+        packets_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /** @brief Expect @c packet_rate data packets per second from now
+     *  on, as the rotation rate or the return mode changed.
+     */
+    void setPacketRate(double packet_rate)
+    {
+        packet_rate_.store(packet_rate, boost::memory_order_relaxed);
+    }
+
+    void gpsReceived()
+    {
+        gps_packets_.fetch_add(1, boost::memory_order_relaxed);
+        last_gps_nsec_.store(ros::WallTime::now().toNSec(),
+                             boost::memory_order_relaxed);
+    }
+
+    /** @brief Check the device timestamp of a dequeued packet for
+     *  packets lost before it.  Called from the conversion thread only.
+     */
+    void packetTimestamp(uint32_t usec);
+
+    /** @brief Packets were discarded without being converted. */
+    void packetDropped(size_t count = 1)
+    {
+        dropped_.fetch_add(count, boost::memory_order_relaxed);
+    }
+
+    /** @brief Converted frames were discarded without being published. */
+    void frameDropped(size_t count = 1)
+    {
+        frames_dropped_.fetch_add(count, boost::memory_order_relaxed);
+    }
+
+    void queueDepth(size_t depth)
+    {
+        queue_depth_.store(depth, boost::memory_order_relaxed);
+        size_t max = queue_max_.load(boost::memory_order_relaxed);
+        if (depth > max)
+            queue_max_.store(depth, boost::memory_order_relaxed);
+    }
+
+    /** @brief A frame was assembled.
+     *
+     *  @param points points in the frame
+     *  @param coverage fraction of the revolution it covers
+     *  @param gps_stamped whether the stamp comes from the GPS time base
+     *  @param published false if it was suppressed as incomplete
+     */
+    void frame(size_t points, double coverage, bool gps_stamped,
+               bool published);
+
+    /** @brief Diagnostic task, reports rates since the last call. */
+    void report(diagnostic_updater::DiagnosticStatusWrapper &status);
+
+private:
+
+    boost::atomic<double> packet_rate_;
+
+    boost::atomic<uint64_t> packets_;
+    boost::atomic<uint64_t> gps_packets_;
+    boost::atomic<uint64_t> lost_;
+    boost::atomic<uint64_t> dropped_;
+    boost::atomic<uint64_t> frames_;
+    boost::atomic<uint64_t> points_;
+    boost::atomic<uint64_t> coverage_ppm_;
+    boost::atomic<uint64_t> suppressed_;
+    boost::atomic<uint64_t> frames_dropped_;
+    boost::atomic<uint64_t> last_gps_nsec_;
+    boost::atomic<size_t> queue_depth_;
+    boost::atomic<size_t> queue_max_;
+    boost::atomic<bool> gps_stamped_;
+
+    // conversion thread only
+    uint32_t last_usec_;
+    bool have_usec_;
+
+    // report() only: counter values at the previous report
+    double last_report_;
+    uint64_t last_packets_;
+    uint64_t last_gps_packets_;
+    uint64_t last_lost_;
+    uint64_t last_dropped_;
+    uint64_t last_frames_;
+    uint64_t last_points_;
+    uint64_t last_coverage_ppm_;
+    uint64_t last_suppressed_;
+    uint64_t last_frames_dropped_;
+};
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_METRICS_H_
@@ -0,0 +1,321 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Dumps every Nth Pandar40 cloud to a binary PCD or PLY file.
+
+    Files are written by a pool of threads, each packing the points
+    into its own preallocated buffer and writing it with O_DIRECT, so
+    that the dump does not fill the page cache.  File systems without
+    O_DIRECT support get buffered writes instead.  A file only appears
+    under its final name once it is complete.
+
+*/
+
+#include "pcd_dump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace
+{
+  /** O_DIRECT needs buffers, sizes and offsets aligned to blocks */
+  const size_t DIRECT_ALIGN = 4096;
+
+  /** x y z intensity timestamp ring, packed */
+  const size_t POINT_SIZE = 4 + 4 + 4 + 1 + 8 + 2;
+
+  size_t alignUp(size_t n)
+  {
+    return (n + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+  }
+
+  int writeAll(int fd, const uint8_t *p, size_t size)
+  {
+    while (size > 0)
+      {
+        ssize_t n = write(fd, p, size);
+        if (n < 0)
+          {
+            if (errno == EINTR)
+              continue;
+            return errno;
+          }
+        p += n;
+        size -= n;
+      }
+    return 0;
+  }
+}
+
+namespace pandar_pointcloud
+{
+  bool AlignedBuffer::reserve(size_t size)
+  {
+    if (size <= capacity_)
+      return true;
+    void *p;
+    size = alignUp(size);
+    if (posix_memalign(&p, DIRECT_ALIGN, size) != 0)
+      return false;
+    free(data_);
+    data_ = (uint8_t *) p;
+    capacity_ = size;
+    return true;
+  }
+
+  /** @brief Constructor. */
+  PcdDump::PcdDump(ros::NodeHandle node, ros::NodeHandle private_nh):
+    received_(0), written_(0), failed_(0), bytes_(0), last_bytes_(0),
+    last_report_(ros::WallTime::now().toSec())
+  {
+    std::string format;
+    bool direct;
+    int writers, queue_size;
+    private_nh.param("directory", config_.directory, std::string("."));
+    private_nh.param("prefix", config_.prefix, std::string("pandar_"));
+    private_nh.param("format", format, std::string("pcd"));
+    private_nh.param("every_n", config_.every_n, 10);
+    private_nh.param("writers", writers, 2);
+    private_nh.param("queue_size", queue_size, 4);
+    private_nh.param("direct_io", direct, true);
+    private_nh.param("buffer_points", config_.buffer_points, 150000);
+    config_.every_n = std::max(config_.every_n, 1);
+    config_.ply = (format == "ply");
+    if (!config_.ply && format != "pcd")
+      ROS_WARN_STREAM("unknown format " << format << ", using pcd");
+    direct_ = direct;
+
+    ROS_INFO("dumping one frame in %d to %s/%s*.%s, %d writers",
+             config_.every_n, config_.directory.c_str(),
+             config_.prefix.c_str(), config_.ply ? "ply" : "pcd",
+             std::max(writers, 1));
+
+    queue_.reset(new BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr>(
+                   std::max(queue_size, 1),
+                   BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr>::
+                   DROP_OLDEST));
+    for (int i = 0; i < std::max(writers, 1); ++i)
+      writers_.create_thread(boost::bind(&PcdDump::writeThread, this));
+
+    diagnostics_.setHardwareID("HesaiPandar40");
+    diagnostics_.add("pcd dump", this, &PcdDump::report);
+    diag_timer_ = node.createTimer(ros::Duration(1.0),
+                                   &PcdDump::diagTimerCallback, this);
+
+    input_ =
+      node.subscribe("pandar_points", 10,
+                     &PcdDump::dumpPoints, this,
+                     ros::TransportHints().tcpNoDelay(true));
+  }
+
+  PcdDump::~PcdDump()
+  {
+    input_.shutdown();
+    queue_->stop();
+    writers_.join_all();
+  }
+
+  /** @brief Callback for Pandar40 point clouds. */
+  void
+    PcdDump::dumpPoints(const pandar_rawdata::PPointCloud::ConstPtr &inMsg)
+  {
+    if (received_++ % config_.every_n != 0)
+      return;
+    if (queue_->push(inMsg))
+      ROS_WARN_THROTTLE(10, "disk falls behind, %llu frames skipped",
+                        (unsigned long long) queue_->dropped());
+  }
+
+  /** @brief Writes queued clouds, one of the writer pool. */
+  void PcdDump::writeThread()
+  {
+    AlignedBuffer buffer;
+    if (!buffer.reserve(1024 + config_.buffer_points * POINT_SIZE))
+      ROS_WARN("cannot preallocate a write buffer");
+
+    pandar_rawdata::PPointCloud::ConstPtr cloud;
+    size_t depth;
+    while (true)
+      {
+        // queued clouds are still written once stopped
+        if (!queue_->pop(cloud, depth, boost::posix_time::seconds(1)))
+          {
+            if (queue_->stopped())
+              return;
+            continue;
+          }
+        if (writeFile(*cloud, buffer))
+          written_.fetch_add(1, boost::memory_order_relaxed);
+        else
+          failed_.fetch_add(1, boost::memory_order_relaxed);
+        cloud.reset();
+      }
+  }
+
+  /** @brief Write one cloud, packed after a PCD or PLY header. */
+  bool PcdDump::writeFile(const pandar_rawdata::PPointCloud &pc,
+                          AlignedBuffer &buffer)
+  {
+    size_t points = pc.points.size();
+    char header[512];
+    int header_size;
+    if (config_.ply)
+      header_size =
+        snprintf(header, sizeof(header),
+                 "ply\n"
+                 "format binary_little_endian 1.0\n"
+                 "comment frame_id %s stamp %llu\n"
+                 "element vertex %zu\n"
+                 "property float x\n"
+                 "property float y\n"
+                 "property float z\n"
+                 "property uchar intensity\n"
+                 "property double timestamp\n"
+                 "property ushort ring\n"
+                 "end_header\n",
+                 pc.header.frame_id.c_str(),
+                 (unsigned long long) pc.header.stamp, points);
+    else
+      header_size =
+        snprintf(header, sizeof(header),
+                 "# .PCD v0.7 - Point Cloud Data file format\n"
+                 "# frame_id %s stamp %llu\n"
+                 "VERSION 0.7\n"
+                 "FIELDS x y z intensity timestamp ring\n"
+                 "SIZE 4 4 4 1 8 2\n"
+                 "TYPE F F F U F U\n"
+                 "COUNT 1 1 1 1 1 1\n"
+                 "WIDTH %zu\n"
+                 "HEIGHT 1\n"
+                 "VIEWPOINT 0 0 0 1 0 0 0\n"
+                 "POINTS %zu\n"
+                 "DATA binary\n",
+                 pc.header.frame_id.c_str(),
+                 (unsigned long long) pc.header.stamp, points, points);
+
+    if (header_size < 0 || header_size >= (int) sizeof(header))
+      {
+        ROS_ERROR_THROTTLE(10, "frame_id %s too long to dump",
+                           pc.header.frame_id.c_str());
+        return false;
+      }
+
+    size_t size = header_size + points * POINT_SIZE;
+    if (!buffer.reserve(size))
+      {
+        ROS_ERROR("cannot allocate %zu bytes to dump a frame", size);
+        return false;
+      }
+    uint8_t *p = buffer.data();
+    memcpy(p, header, header_size);
+    p += header_size;
+    for (size_t i = 0; i < points; ++i)
+      {
+        const pandar_rawdata::PPoint &point = pc.points[i];
+        memcpy(p, &point.x, 4);
+        memcpy(p + 4, &point.y, 4);
+        memcpy(p + 8, &point.z, 4);
+        p[12] = point.intensity;
+        memcpy(p + 13, &point.timestamp, 8);
+        memcpy(p + 21, &point.ring, 2);
+        p += POINT_SIZE;
+      }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%llu.%06llu.%s",
+             (unsigned long long) pc.header.stamp / 1000000,
+             (unsigned long long) pc.header.stamp % 1000000,
+             config_.ply ? "ply" : "pcd");
+    std::string path = config_.directory + "/" + config_.prefix + name;
+    std::string tmp_path = path + ".tmp";
+
+    bool direct = direct_;
+    int fd = open(tmp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0),
+                  0644);
+    if (fd < 0 && direct && errno == EINVAL)
+      {
+        ROS_INFO("%s does not support O_DIRECT, using buffered writes",
+                 config_.directory.c_str());
+        direct_ = direct = false;
+        fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      }
+    if (fd < 0)
+      {
+        ROS_ERROR_THROTTLE(10, "cannot create %s: %s", tmp_path.c_str(),
+                           strerror(errno));
+        return false;
+      }
+
+    // O_DIRECT writes whole blocks, the padding is cut off afterwards
+    size_t write_size = size;
+    if (direct)
+      {
+        write_size = alignUp(size);
+        memset(buffer.data() + size, 0, write_size - size);
+      }
+    int err = writeAll(fd, buffer.data(), write_size);
+    if (!err && write_size != size && ftruncate(fd, size) != 0)
+      err = errno;
+    if (close(fd) != 0 && !err)
+      err = errno;
+    if (!err && rename(tmp_path.c_str(), path.c_str()) != 0)
+      err = errno;
+    if (err)
+      {
+        ROS_ERROR_THROTTLE(10, "cannot write %s: %s", path.c_str(),
+                           strerror(err));
+        unlink(tmp_path.c_str());
+        return false;
+      }
+    bytes_.fetch_add(size, boost::memory_order_relaxed);
+    return true;
+  }
+
+  /** @brief Diagnostic task, frames written and skipped. */
+  void PcdDump::report(diagnostic_updater::DiagnosticStatusWrapper &status)
+  {
+    double now = ros::WallTime::now().toSec();
+    double elapsed = now - last_report_;
+    if (elapsed <= 0.0)
+      elapsed = 1.0;
+    last_report_ = now;
+    uint64_t bytes = bytes_.load(boost::memory_order_relaxed);
+    double rate = (bytes - last_bytes_) / elapsed;
+    last_bytes_ = bytes;
+
+    uint64_t skipped = queue_->dropped();
+    uint64_t failed = failed_.load(boost::memory_order_relaxed);
+    if (failed)
+      status.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
+                     "frames could not be written");
+    else if (skipped)
+      status.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                     "frames skipped, the disk falls behind");
+    else
+      status.summary(diagnostic_msgs::DiagnosticStatus::OK, "ok");
+
+    status.addf("frames written", "%llu", (unsigned long long)
+                written_.load(boost::memory_order_relaxed));
+    status.addf("frames skipped", "%llu", (unsigned long long) skipped);
+    status.addf("frames failed", "%llu", (unsigned long long) failed);
+    status.addf("queue depth", "%zu", queue_->size());
+    status.addf("write rate (MB/s)", "%.1f", rate * 1e-6);
+    status.add("direct I/O", std::string(direct_ ? "yes" : "no"));
+  }
+
+  void PcdDump::diagTimerCallback(const ros::TimerEvent &event)
+  {
+    diagnostics_.update();
+  }
+
+} // namespace pandar_pointcloud
@@ -0,0 +1,102 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Dumps every Nth Pandar40 cloud of pandar_points to a binary PCD or
+    PLY file, with the timestamp of every point, for dataset capture.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_PCD_DUMP_H_
+#define _PANDAR_POINTCLOUD_PCD_DUMP_H_
+
+#include <ros/ros.h>
+#include <pcl_ros/point_cloud.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <pandar_pointcloud/rawdata.h>
+
+#include "bounded_queue.h"
+
+namespace pandar_pointcloud
+{
+  /** write buffer aligned for O_DIRECT, owned by one writer thread */
+  class AlignedBuffer
+  {
+  public:
+
+    AlignedBuffer(): data_(NULL), capacity_(0) {}
+    ~AlignedBuffer() { free(data_); }
+
+    /** @returns false if the memory can not be allocated */
+    bool reserve(size_t size);
+    uint8_t *data() { return data_; }
+
+  private:
+
+    AlignedBuffer(const AlignedBuffer &);
+    AlignedBuffer &operator=(const AlignedBuffer &);
+
+    uint8_t *data_;
+    size_t capacity_;
+  };
+
+  class PcdDump
+  {
+  public:
+
+    PcdDump(ros::NodeHandle node, ros::NodeHandle private_nh);
+    ~PcdDump();
+
+  private:
+
+    void dumpPoints(const pandar_rawdata::PPointCloud::ConstPtr &inMsg);
+    void writeThread();
+    bool writeFile(const pandar_rawdata::PPointCloud &pc,
+                   AlignedBuffer &buffer);
+    void report(diagnostic_updater::DiagnosticStatusWrapper &status);
+    void diagTimerCallback(const ros::TimerEvent &event);
+
+    ros::Subscriber input_;
+
+    /// configuration parameters
+    typedef struct {
+      std::string directory;           ///< where the files go
+      std::string prefix;              ///< file name prefix
+      bool ply;                        ///< PLY instead of PCD
+      int every_n;                     ///< dump one frame in every_n
+      int buffer_points;               ///< points preallocated per writer
+    } Config;
+    Config config_;
+
+    /** O_DIRECT writes, until the file system refuses them */
+    boost::atomic<bool> direct_;
+
+    uint64_t received_;                ///< subscriber callback only
+
+    /** frames selected but not yet written; a frame is skipped when
+        the writers fall queue_size frames behind */
+    boost::shared_ptr<BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr> >
+      queue_;
+    boost::thread_group writers_;
+
+    boost::atomic<uint64_t> written_;
+    boost::atomic<uint64_t> failed_;
+    boost::atomic<uint64_t> bytes_;
+    uint64_t last_bytes_;
+    double last_report_;
+
+    diagnostic_updater::Updater diagnostics_;
+    ros::Timer diag_timer_;
+  };
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_PCD_DUMP_H_
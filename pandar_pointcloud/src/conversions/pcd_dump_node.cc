@@ -0,0 +1,32 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS node dumps every Nth Pandar40 cloud to a binary PCD or
+    PLY file.
+
+*/
+
+#include <ros/ros.h>
+#include "pcd_dump.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "pcd_dump_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  // create the dump, which subscribes to pandar_points
+  pandar_pointcloud::PcdDump dump(node, priv_nh);
+
+  // handle callbacks until shut down
+  ros::spin();
+
+  return 0;
+}
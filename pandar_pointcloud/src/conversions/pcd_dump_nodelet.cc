@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS nodelet dumps every Nth Pandar40 cloud to a binary PCD or
+    PLY file.
+
+*/
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "pcd_dump.h"
+
+namespace pandar_pointcloud
+{
+  class PcdDumpNodelet: public nodelet::Nodelet
+  {
+  public:
+
+    PcdDumpNodelet() {}
+    ~PcdDumpNodelet() {}
+
+  private:
+
+    virtual void onInit();
+    boost::shared_ptr<PcdDump> dump_;
+  };
+
+  /** @brief Nodelet initialization. */
+  void PcdDumpNodelet::onInit()
+  {
+    dump_.reset(new PcdDump(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+} // namespace pandar_pointcloud
+
+
+// Register this plugin with pluginlib.  Names must match nodelets.xml.
+//
+// parameters: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(pandar_pointcloud, PcdDumpNodelet,
+                        pandar_pointcloud::PcdDumpNodelet, nodelet::Nodelet);
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Records the decoded Pandar40 clouds of pandar_points in the native
+    recording format.
+
+*/
+
+#include "record.h"
+
+#include <string.h>
+
+namespace pandar_pointcloud
+{
+  /** @brief Constructor. */
+  CloudRecorder::CloudRecorder(ros::NodeHandle node,
+                               ros::NodeHandle private_nh)
+  {
+    int chunk_frames, compression, queue_size;
+    private_nh.param("file", path_, std::string("pandar.pcr"));
+    private_nh.param("chunk_frames", chunk_frames, 10);
+    private_nh.param("compression", compression, 0);
+    private_nh.param("queue_size", queue_size, 20);
+
+    int rc = writer_.open(path_, chunk_frames, compression);
+    if (rc != 0)
+      {
+        ROS_ERROR("cannot record to %s: %s", path_.c_str(), strerror(rc));
+        return;
+      }
+    ROS_INFO("recording pandar_points to %s, %d frames per chunk%s",
+             path_.c_str(), chunk_frames,
+             compression > 0 ? ", compressed" : "");
+
+    queue_.reset(new BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr>(
+                   std::max(queue_size, 1),
+                   BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr>::
+                   DROP_OLDEST));
+    thread_ = boost::thread(boost::bind(&CloudRecorder::writeThread, this));
+
+    input_ =
+      node.subscribe("pandar_points", 10,
+                     &CloudRecorder::recordPoints, this,
+                     ros::TransportHints().tcpNoDelay(true));
+  }
+
+  CloudRecorder::~CloudRecorder()
+  {
+    input_.shutdown();
+    if (queue_)
+      {
+        queue_->stop();
+        thread_.join();
+      }
+    int rc = writer_.close();
+    if (rc != 0)
+      ROS_ERROR("error closing %s: %s", path_.c_str(), strerror(rc));
+  }
+
+  /** @brief Callback for Pandar40 point clouds. */
+  void
+    CloudRecorder::recordPoints(const pandar_rawdata::PPointCloud::ConstPtr &inMsg)
+  {
+    if (queue_->push(inMsg))
+      ROS_WARN_THROTTLE(10, "recording falls behind, %llu frames dropped",
+                        (unsigned long long) queue_->dropped());
+  }
+
+  /** @brief Writes queued clouds, on its own thread. */
+  void CloudRecorder::writeThread()
+  {
+    pandar_rawdata::PPointCloud::ConstPtr cloud;
+    size_t depth;
+    while (true)
+      {
+        // queued clouds are still written once stopped
+        if (!queue_->pop(cloud, depth, boost::posix_time::seconds(1)))
+          {
+            if (queue_->stopped())
+              return;
+            continue;
+          }
+        int rc = writer_.write(*cloud);
+        cloud.reset();
+        if (rc != 0)
+          {
+            ROS_ERROR("error recording to %s: %s", path_.c_str(),
+                      strerror(rc));
+            return;
+          }
+      }
+  }
+
+} // namespace pandar_pointcloud
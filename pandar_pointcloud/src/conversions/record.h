@@ -0,0 +1,53 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Records the decoded Pandar40 clouds of pandar_points in the native
+    recording format, see pandar_pointcloud/cloud_record.h.
+
+*/
+
+#ifndef _PANDAR_POINTCLOUD_RECORD_H_
+#define _PANDAR_POINTCLOUD_RECORD_H_
+
+#include <ros/ros.h>
+#include <pcl_ros/point_cloud.h>
+#include <boost/thread/thread.hpp>
+#include <pandar_pointcloud/cloud_record.h>
+
+#include "bounded_queue.h"
+
+namespace pandar_pointcloud
+{
+  class CloudRecorder
+  {
+  public:
+
+    CloudRecorder(ros::NodeHandle node, ros::NodeHandle private_nh);
+    ~CloudRecorder();
+
+  private:
+
+    void recordPoints(const pandar_rawdata::PPointCloud::ConstPtr &inMsg);
+    void writeThread();
+
+    ros::Subscriber input_;
+    std::string path_;
+    CloudRecordWriter writer_;
+
+    /** clouds received but not yet written, so that a slow disk
+        never holds up the subscriber callbacks */
+    boost::shared_ptr<BoundedQueue<pandar_rawdata::PPointCloud::ConstPtr> >
+      queue_;
+    boost::thread thread_;
+  };
+
+} // namespace pandar_pointcloud
+
+#endif // _PANDAR_POINTCLOUD_RECORD_H_
@@ -0,0 +1,32 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS node records decoded Pandar40 clouds in the native
+    recording format.
+
+*/
+
+#include <ros/ros.h>
+#include "record.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "record_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  // create the recorder, which subscribes to pandar_points
+  pandar_pointcloud::CloudRecorder recorder(node, priv_nh);
+
+  // handle callbacks until shut down
+  ros::spin();
+
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    This ROS nodelet records decoded Pandar40 clouds in the native
+    recording format.
+
+*/
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "record.h"
+
+namespace pandar_pointcloud
+{
+  class CloudRecorderNodelet: public nodelet::Nodelet
+  {
+  public:
+
+    CloudRecorderNodelet() {}
+    ~CloudRecorderNodelet() {}
+
+  private:
+
+    virtual void onInit();
+    boost::shared_ptr<CloudRecorder> recorder_;
+  };
+
+  /** @brief Nodelet initialization. */
+  void CloudRecorderNodelet::onInit()
+  {
+    recorder_.reset(new CloudRecorder(getNodeHandle(),
+                                      getPrivateNodeHandle()));
+  }
+
+} // namespace pandar_pointcloud
+
+
+// Register this plugin with pluginlib.  Names must match nodelets.xml.
+//
+// parameters: package, class name, class type, base class type
+PLUGINLIB_DECLARE_CLASS(pandar_pointcloud, CloudRecorderNodelet,
+                        pandar_pointcloud::CloudRecorderNodelet,
+                        nodelet::Nodelet);
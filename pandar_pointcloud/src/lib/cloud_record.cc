@@ -0,0 +1,404 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Native recording format of decoded Pandar40 clouds.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <pandar_pointcloud/cloud_record.h>
+
+namespace pandar_pointcloud
+{
+using pandar_rawdata::PPoint;
+using pandar_rawdata::PPointCloud;
+
+static uint64_t alignUp(uint64_t n, uint64_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+/** offset of the points from the start of a chunk of @c frames */
+static uint64_t chunkPointsOffset(uint32_t frames)
+{
+    return alignUp(sizeof(record_chunk_t)
+                   + frames * sizeof(record_chunk_frame_t), 64);
+}
+
+static int writeAll(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// CloudRecordWriter
+////////////////////////////////////////////////////////////////////////
+
+CloudRecordWriter::CloudRecordWriter():
+    fd_(-1), chunk_frames_(1), compression_(0), offset_(0)
+{}
+
+CloudRecordWriter::~CloudRecordWriter()
+{
+    close();
+}
+
+int CloudRecordWriter::open(const std::string &path, int chunk_frames,
+                            int compression)
+{
+    close();
+#ifndef HAVE_ZLIB
+    if (compression > 0)
+        return ENOTSUP;
+#endif
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return errno;
+
+    fd_ = fd;
+    chunk_frames_ = std::max(chunk_frames, 1);
+    compression_ = std::min(std::max(compression, 0), 9);
+    offset_ = RECORD_ALIGN;
+    frame_id_.clear();
+    chunk_table_.clear();
+    chunk_points_.clear();
+    index_.clear();
+
+    int err = writeHeader(0);
+    if (err)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    return err;
+}
+
+int CloudRecordWriter::writeHeader(uint64_t index_offset)
+{
+    std::vector<uint8_t> page(RECORD_ALIGN, 0);
+    record_header_t *header = (record_header_t *) &page[0];
+    header->magic = RECORD_MAGIC;
+    header->version = RECORD_VERSION;
+    header->point_size = sizeof(PPoint);
+    header->frames = index_offset ? index_.size() : 0;
+    header->index_offset = index_offset;
+    strncpy(header->frame_id, frame_id_.c_str(), sizeof(header->frame_id) - 1);
+    return writeAll(fd_, &page[0], page.size(), 0);
+}
+
+int CloudRecordWriter::write(const PPointCloud &pc)
+{
+    if (fd_ < 0)
+        return EBADF;
+    if (frame_id_.empty())
+        frame_id_ = pc.header.frame_id;
+
+    record_chunk_frame_t entry;
+    entry.stamp = pc.header.stamp;
+    entry.points = pc.points.size();
+    entry.reserved = 0;
+
+    record_index_t index;
+    index.stamp = entry.stamp;
+    index.chunk_offset = offset_;
+    index.point_offset = chunk_points_.size();
+    index.points = entry.points;
+    index.reserved = 0;
+
+    const uint8_t *p = (const uint8_t *) (pc.points.empty() ? NULL : &pc.points[0]);
+    chunk_points_.insert(chunk_points_.end(), p,
+                         p + pc.points.size() * sizeof(PPoint));
+    chunk_table_.push_back(entry);
+    index_.push_back(index);
+
+    if ((int) chunk_table_.size() >= chunk_frames_)
+        return flushChunk();
+    return 0;
+}
+
+int CloudRecordWriter::flushChunk()
+{
+    if (chunk_table_.empty())
+        return 0;
+
+    uint32_t frames = chunk_table_.size();
+    uint64_t points_offset = chunkPointsOffset(frames);
+    uint64_t raw_size = chunk_points_.size();
+
+    buffer_.assign(points_offset, 0);
+    record_chunk_t *chunk = (record_chunk_t *) &buffer_[0];
+    chunk->magic = RECORD_CHUNK_MAGIC;
+    chunk->frames = frames;
+    chunk->compression = RECORD_NONE;
+    chunk->raw_size = raw_size;
+    memcpy(&buffer_[sizeof(record_chunk_t)], &chunk_table_[0],
+           frames * sizeof(record_chunk_frame_t));
+
+    uint64_t stored_size = raw_size;
+#ifdef HAVE_ZLIB
+    if (compression_ > 0 && raw_size > 0)
+    {
+        uLongf size = compressBound(raw_size);
+        buffer_.resize(points_offset + size);
+        if (compress2(&buffer_[points_offset], &size, &chunk_points_[0],
+                      raw_size, compression_) == Z_OK && size < raw_size)
+        {
+            stored_size = size;
+            ((record_chunk_t *) &buffer_[0])->compression = RECORD_ZLIB;
+        }
+    }
+#endif
+    buffer_.resize(points_offset + stored_size);
+    if (stored_size == raw_size && raw_size > 0)
+        memcpy(&buffer_[points_offset], &chunk_points_[0], raw_size);
+
+    // every chunk starts on a page
+    buffer_.resize(alignUp(buffer_.size(), RECORD_ALIGN), 0);
+    chunk = (record_chunk_t *) &buffer_[0];
+    chunk->stored_size = stored_size;
+    chunk->next_offset = offset_ + buffer_.size();
+
+    int err = writeAll(fd_, &buffer_[0], buffer_.size(), offset_);
+    if (err)
+        return err;
+
+    // the first chunk also knows the frame ID
+    if (offset_ == RECORD_ALIGN)
+        err = writeHeader(0);
+    offset_ += buffer_.size();
+    chunk_table_.clear();
+    chunk_points_.clear();
+    return err;
+}
+
+int CloudRecordWriter::close()
+{
+    if (fd_ < 0)
+        return 0;
+
+    int err = flushChunk();
+    if (!err && !index_.empty())
+        err = writeAll(fd_, &index_[0], index_.size() * sizeof(record_index_t),
+                       offset_);
+    if (!err)
+        err = writeHeader(offset_);
+    if (::close(fd_) != 0 && !err)
+        err = errno;
+    fd_ = -1;
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////
+// CloudRecordReader
+////////////////////////////////////////////////////////////////////////
+
+CloudRecordReader::CloudRecordReader():
+    base_(NULL), size_(0), cached_chunk_(0)
+{}
+
+CloudRecordReader::~CloudRecordReader()
+{
+    close();
+}
+
+int CloudRecordReader::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+    if ((size_t) st.st_size < RECORD_ALIGN)
+    {
+        ::close(fd);
+        return EPROTO;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+        return errno;
+    base_ = (const uint8_t *) base;
+    size_ = st.st_size;
+
+    const record_header_t *header = (const record_header_t *) base_;
+    if (header->magic != RECORD_MAGIC || header->version != RECORD_VERSION
+        || header->point_size != sizeof(PPoint))
+    {
+        close();
+        return EPROTO;
+    }
+    frame_id_.assign(header->frame_id,
+                     strnlen(header->frame_id, sizeof(header->frame_id)));
+
+    if (header->index_offset != 0
+        && header->index_offset + header->frames * sizeof(record_index_t)
+           <= size_)
+    {
+        const record_index_t *index =
+            (const record_index_t *) (base_ + header->index_offset);
+        index_.assign(index, index + header->frames);
+    }
+    else if (!rebuildIndex())
+    {
+        close();
+        return EPROTO;
+    }
+    return 0;
+}
+
+/** @brief Walk the chunks of a recording that was not closed. */
+bool CloudRecordReader::rebuildIndex()
+{
+    index_.clear();
+    uint64_t offset = RECORD_ALIGN;
+    while (offset + sizeof(record_chunk_t) <= size_)
+    {
+        const record_chunk_t *chunk = (const record_chunk_t *) (base_ + offset);
+        if (chunk->magic != RECORD_CHUNK_MAGIC
+            || chunk->next_offset <= offset || chunk->next_offset > size_
+            || offset + chunkPointsOffset(chunk->frames) > chunk->next_offset)
+            break;                      // end of what was written
+
+        const record_chunk_frame_t *table =
+            (const record_chunk_frame_t *) (chunk + 1);
+        uint64_t point_offset = 0;
+        for (uint32_t i = 0; i < chunk->frames; ++i)
+        {
+            record_index_t index;
+            index.stamp = table[i].stamp;
+            index.chunk_offset = offset;
+            index.point_offset = point_offset;
+            index.points = table[i].points;
+            index.reserved = 0;
+            index_.push_back(index);
+            point_offset += table[i].points * sizeof(PPoint);
+        }
+        offset = chunk->next_offset;
+    }
+    return offset > RECORD_ALIGN || size_ == RECORD_ALIGN;
+}
+
+void CloudRecordReader::close()
+{
+    if (base_)
+        munmap((void *) base_, size_);
+    base_ = NULL;
+    size_ = 0;
+    index_.clear();
+    cached_chunk_ = 0;
+    cache_.clear();
+}
+
+const uint8_t *CloudRecordReader::chunkPoints(uint64_t chunk_offset)
+{
+    if (chunk_offset + sizeof(record_chunk_t) > size_)
+        return NULL;
+    const record_chunk_t *chunk = (const record_chunk_t *) (base_ + chunk_offset);
+    uint64_t start = chunk_offset + chunkPointsOffset(chunk->frames);
+    if (chunk->magic != RECORD_CHUNK_MAGIC
+        || start + chunk->stored_size > size_)
+        return NULL;
+
+    if (chunk->compression == RECORD_NONE)
+        return base_ + start;
+
+#ifdef HAVE_ZLIB
+    if (chunk->compression == RECORD_ZLIB)
+    {
+        if (cached_chunk_ != chunk_offset)
+        {
+            cache_.resize(chunk->raw_size);
+            uLongf size = chunk->raw_size;
+            cached_chunk_ = 0;
+            if (uncompress(&cache_[0], &size, base_ + start,
+                           chunk->stored_size) != Z_OK
+                || size != chunk->raw_size)
+                return NULL;
+            cached_chunk_ = chunk_offset;
+        }
+        return &cache_[0];
+    }
+#endif
+    return NULL;
+}
+
+const PPoint *CloudRecordReader::points(size_t n, uint32_t &count)
+{
+    if (n >= index_.size())
+        return NULL;
+    const record_index_t &index = index_[n];
+    const uint8_t *p = chunkPoints(index.chunk_offset);
+    if (p == NULL)
+        return NULL;
+    const record_chunk_t *chunk =
+        (const record_chunk_t *) (base_ + index.chunk_offset);
+    if (index.point_offset + index.points * sizeof(PPoint) > chunk->raw_size)
+        return NULL;
+    count = index.points;
+    return (const PPoint *) (p + index.point_offset);
+}
+
+bool CloudRecordReader::read(size_t n, PPointCloud &pc)
+{
+    uint32_t count;
+    const PPoint *p = points(n, count);
+    if (p == NULL)
+        return false;
+    pc.points.assign(p, p + count);
+    pc.width = count;
+    pc.height = 1;
+    pc.header.stamp = index_[n].stamp;
+    pc.header.frame_id = frame_id_;
+    return true;
+}
+
+static bool stampBefore(const record_index_t &index, uint64_t stamp)
+{
+    return index.stamp < stamp;
+}
+
+size_t CloudRecordReader::seek(uint64_t stamp) const
+{
+    return std::lower_bound(index_.begin(), index_.end(), stamp, stampBefore)
+           - index_.begin();
+}
+
+} // namespace pandar_pointcloud
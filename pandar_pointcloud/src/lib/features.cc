@@ -0,0 +1,189 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Edge and planar feature points of a Pandar40 frame, picked while it
+ *  is decoded.
+ */
+
+#include <algorithm>
+#include <stdlib.h>
+
+#include <pandar_pointcloud/features.h>
+
+namespace pandar_rawdata
+{
+FeatureExtractor::FeatureExtractor(const feature_config_t &config):
+    config_(config),
+    edges_(new Cloud()), planars_(new Cloud()),
+    doneEdges_(new Cloud()), donePlanars_(new Cloud())
+{
+    if (config_.sectors < 1)
+        config_.sectors = 1;
+    for (int r = 0; r < MAX_RINGS; ++r)
+    {
+        rings_[r].next = 0;
+        rings_[r].count = 0;
+        rings_[r].lastAzimuth = 0;
+        rings_[r].sequence = 0;
+        rings_[r].sector = -1;
+        rings_[r].sum[0] = rings_[r].sum[1] = rings_[r].sum[2] = 0.0;
+    }
+}
+
+void FeatureExtractor::add(const Point &point, int azimuth)
+{
+    if (point.ring >= MAX_RINGS)
+        return;
+    Ring &ring = rings_[point.ring];
+
+    // neighbours across a gap are not neighbours on the surface
+    if (ring.count > 0
+        && (azimuth - ring.lastAzimuth + 36000) % 36000 > MAX_GAP)
+    {
+        ring.count = 0;
+        ring.sum[0] = ring.sum[1] = ring.sum[2] = 0.0;
+    }
+    ring.lastAzimuth = azimuth;
+
+    // the sums of the window follow the points in and out of it
+    if (ring.count == WINDOW)
+    {
+        const Point &out = ring.window[ring.next];
+        ring.sum[0] -= out.x;
+        ring.sum[1] -= out.y;
+        ring.sum[2] -= out.z;
+    }
+    else
+    {
+        ring.count++;
+    }
+    ring.window[ring.next] = point;
+    ring.windowAzimuth[ring.next] = azimuth;
+    ring.sum[0] += point.x;
+    ring.sum[1] += point.y;
+    ring.sum[2] += point.z;
+    ring.next = (ring.next + 1) % WINDOW;
+    ring.sequence++;
+    if (ring.count < WINDOW)
+        return;
+
+    // the window is full: its middle point has all its neighbours
+    int middle = (ring.next + WINDOW / 2) % WINDOW;
+    const Point &p = ring.window[middle];
+    float dx = ring.sum[0] - WINDOW * p.x;
+    float dy = ring.sum[1] - WINDOW * p.y;
+    float dz = ring.sum[2] - WINDOW * p.z;
+    int sector = ring.windowAzimuth[middle] * config_.sectors / 36000;
+    if (sector != ring.sector)
+    {
+        flushSector(ring);
+        ring.sector = sector;
+    }
+    Candidate c;
+    c.point = p;
+    c.smoothness = dx * dx + dy * dy + dz * dz;
+    c.sequence = ring.sequence - 1 - WINDOW / 2;
+    c.picked = false;
+    ring.candidates.push_back(c);
+}
+
+/** @brief Pick the features of the sector of @c ring. */
+void FeatureExtractor::flushSector(Ring &ring)
+{
+    if (!ring.candidates.empty())
+    {
+        pick(ring.candidates, true);
+        pick(ring.candidates, false);
+        ring.candidates.clear();
+    }
+}
+
+/** @brief Pick the sharpest, or the smoothest, candidates past the
+ *  threshold, each at least half a window from those picked before.
+ *
+ *  A pick takes at most WINDOW candidates out, so the picks are among
+ *  the first count * WINDOW in order: only those are sorted, after a
+ *  selection in linear time.
+ */
+void FeatureExtractor::pick(std::vector<Candidate> &candidates, bool edges)
+{
+    int count = edges ? config_.edges : config_.planars;
+    Cloud &cloud = edges ? *edges_ : *planars_;
+    // sharpest first for edges, smoothest first for planar points
+    order_.clear();
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const Candidate &c = candidates[i];
+        if (c.picked || (edges ? c.smoothness <= config_.edge_threshold
+                               : c.smoothness >= config_.planar_threshold))
+            continue;
+        order_.push_back(std::make_pair(edges ? -c.smoothness : c.smoothness,
+                                        (int) i));
+    }
+    size_t sorted = std::min(order_.size(), (size_t) count * WINDOW);
+    if (sorted < order_.size())
+        std::nth_element(order_.begin(), order_.begin() + sorted, order_.end());
+    std::sort(order_.begin(), order_.begin() + sorted);
+
+    int picked = 0;
+    for (size_t n = 0; n < sorted && picked < count; ++n)
+    {
+        int best = order_[n].second;
+        if (candidates[best].picked)
+            continue;
+
+        // the neighbours of a feature are no features of their own;
+        // candidates are in ring order, its neighbours next to it
+        int sequence = candidates[best].sequence;
+        int first = std::max(best - WINDOW / 2, 0);
+        int last = std::min(best + WINDOW / 2, (int) candidates.size() - 1);
+        for (int i = first; i <= last; ++i)
+        {
+            if (abs(candidates[i].sequence - sequence) <= WINDOW / 2)
+                candidates[i].picked = true;
+        }
+        cloud.points.push_back(candidates[best].point);
+        cloud.width++;
+        picked++;
+    }
+}
+
+void FeatureExtractor::endFrame()
+{
+    for (int r = 0; r < MAX_RINGS; ++r)
+    {
+        flushSector(rings_[r]);
+        rings_[r].count = 0;
+        rings_[r].sector = -1;
+        rings_[r].sum[0] = rings_[r].sum[1] = rings_[r].sum[2] = 0.0;
+    }
+    edges_.swap(doneEdges_);
+    planars_.swap(donePlanars_);
+    edges_->clear();
+    planars_->clear();
+}
+
+FeatureExtractor::Cloud::Ptr FeatureExtractor::takeEdges()
+{
+    Cloud::Ptr cloud = doneEdges_;
+    doneEdges_.reset(new Cloud());
+    doneEdges_->points.reserve(cloud->points.size());
+    return cloud;
+}
+
+FeatureExtractor::Cloud::Ptr FeatureExtractor::takePlanars()
+{
+    Cloud::Ptr cloud = donePlanars_;
+    donePlanars_.reset(new Cloud());
+    donePlanars_->points.reserve(cloud->points.size());
+    return cloud;
+}
+
+} // namespace pandar_rawdata
@@ -32,7 +32,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <time.h>
 #include <pandar_pointcloud/input.h>
+#include <pandar_pointcloud/trace.h>
 
 namespace pandar_pointcloud
 {
@@ -50,7 +52,8 @@ namespace pandar_pointcloud
    */
   Input::Input(ros::NodeHandle private_nh, uint16_t port):
     private_nh_(private_nh),
-    port_(port)
+    port_(port),
+    receive_time_(0.0)
   {
     private_nh.param("device_ip", devip_str_, std::string(""));
     if (!devip_str_.empty())
@@ -71,6 +74,7 @@ namespace pandar_pointcloud
     Input(private_nh, port)
   {
     sockfd_ = -1;
+    poll_timeout_ = 1000;               // one second (in msec)
     
     if (!devip_str_.empty()) {
       inet_aton(devip_str_.c_str(),&devip_);
@@ -103,6 +107,11 @@ namespace pandar_pointcloud
         return;
       }
 
+    // ask the kernel to stamp each datagram when it is received
+    int on = 1;
+    if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+      ROS_WARN("SO_TIMESTAMPNS not available, receive times are approximate");
+
     ROS_DEBUG("Pandar socket fd is %d\n", sockfd_);
   }
 
@@ -123,10 +132,11 @@ namespace pandar_pointcloud
     struct pollfd fds[1];
     fds[0].fd = sockfd_;
     fds[0].events = POLLIN;
-    static const int POLL_TIMEOUT = 1000; // one second (in msec)
 
     sockaddr_in sender_address;
-    socklen_t sender_address_len = sizeof(sender_address);
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov;
+    struct msghdr msg;
 
     while (true)
       {
@@ -150,7 +160,7 @@ namespace pandar_pointcloud
         // poll() until input available
         do
           {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
+            int retval = poll(fds, 1, poll_timeout_);
             if (retval < 0)             // poll() error?
               {
                 if (errno != EINTR)
@@ -159,7 +169,8 @@ namespace pandar_pointcloud
               }
             if (retval == 0)            // poll() timeout?
               {
-                ROS_WARN("Pandar poll() timeout");
+                if (poll_timeout_ > 0)
+                  ROS_WARN("Pandar poll() timeout");
                 return 1;
               }
             if ((fds[0].revents & POLLERR)
@@ -172,11 +183,34 @@ namespace pandar_pointcloud
           } while ((fds[0].revents & POLLIN) == 0);
 
         // Receive packets that should now be available from the
-        // socket using a blocking read.
-        ssize_t nbytes = recvfrom(sockfd_, &pkt->data[0],
-                                  packet_size,  0,
-                                  (sockaddr*) &sender_address,
-                                  &sender_address_len);
+        // socket using a blocking read, along with their kernel
+        // receive time.
+        iov.iov_base = &pkt->data[0];
+        iov.iov_len = packet_size;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &sender_address;
+        msg.msg_namelen = sizeof(sender_address);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t nbytes = recvmsg(sockfd_, &msg, 0);
+
+        receive_time_ = 0.0;
+        if (nbytes >= 0)
+          {
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+              {
+                if (cmsg->cmsg_level == SOL_SOCKET
+                    && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                  {
+                    struct timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    receive_time_ = ts.tv_sec + ts.tv_nsec * 1e-9;
+                  }
+              }
+          }
 
         if (nbytes < 0)
           {
@@ -223,6 +257,10 @@ namespace pandar_pointcloud
     // estimate when the scan occurred. Add the time offset.
     double time2 = ros::Time::now().toSec();
     pkt->stamp = ros::Time((time2 + time1) / 2.0 + time_offset);
+    if (receive_time_ == 0.0)
+      receive_time_ = ros::WallTime::now().toSec();
+    PANDAR_TRACE2(packet_receive, isgps ? 512 : packet_size,
+                  (uint64_t) (receive_time_ * 1e9));
     if(isgps)
     {
       return 2;
@@ -315,6 +353,9 @@ namespace pandar_pointcloud
             
             memcpy(&pkt->data[0], pkt_data+42, packet_size);
             pkt->stamp = ros::Time::now(); // time_offset not considered here, as no synchronization required
+            receive_time_ = ros::WallTime::now().toSec();
+            PANDAR_TRACE2(packet_receive, header->caplen - 42,
+                          (uint64_t) (receive_time_ * 1e9));
             empty_ = false;
 
             if(header->caplen == ( 512 + 42) )
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Per laser channel statistics of the Pandar40.
+ */
+
+#include <algorithm>
+#include <string.h>
+
+#include <pandar_pointcloud/laser_health.h>
+
+namespace pandar_rawdata
+{
+static const double RANGE_UNIT = 0.002;      // meters per range count
+
+// a laser is degraded beyond these, compared with the median laser
+static const double DEGRADED_ZERO_MARGIN = 0.5;
+static const double DEGRADED_INTENSITY_RATIO = 0.25;
+
+LaserHealth::LaserHealth(int window_frames):
+    window_(window_frames > 0 ? window_frames : 1),
+    head_(0), frames_(0), stats_frames_(0)
+{
+    memset(current_, 0, sizeof(current_));
+    memset(totals_, 0, sizeof(totals_));
+    memset(stats_, 0, sizeof(stats_));
+    counts_t zero;
+    memset(&zero, 0, sizeof(zero));
+    history_.assign(window_ * LASERS, zero);
+    zero_ratios_.reserve(LASERS);
+    intensities_.reserve(LASERS);
+}
+
+/** the median of @c v, which is reordered */
+static double median(std::vector<double> &v)
+{
+    if (v.empty())
+        return 0.0;
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+void LaserHealth::endFrame()
+{
+    // slide the window: the oldest frame leaves, the current one enters
+    counts_t *oldest = &history_[head_ * LASERS];
+    for (int i = 0; i < LASERS; ++i)
+    {
+        totals_[i].firings += current_[i].firings - oldest[i].firings;
+        totals_[i].zeros += current_[i].zeros - oldest[i].zeros;
+        totals_[i].range_sum += current_[i].range_sum - oldest[i].range_sum;
+        totals_[i].intensity_sum += current_[i].intensity_sum
+                                    - oldest[i].intensity_sum;
+        oldest[i] = current_[i];
+    }
+    memset(current_, 0, sizeof(current_));
+    head_ = (head_ + 1) % window_;
+    if (frames_ < window_)
+        ++frames_;
+
+    laser_stats_t stats[LASERS];
+    zero_ratios_.clear();
+    intensities_.clear();
+    for (int i = 0; i < LASERS; ++i)
+    {
+        const counts_t &t = totals_[i];
+        uint64_t returns = t.firings - t.zeros;
+        laser_stats_t &s = stats[i];
+        s.returns_per_frame = double(returns) / frames_;
+        s.mean_range = returns ? t.range_sum * RANGE_UNIT / returns : 0.0;
+        s.mean_intensity = returns ? double(t.intensity_sum) / returns : 0.0;
+        s.zero_ratio = t.firings ? double(t.zeros) / t.firings : 0.0;
+        s.status = laser_stats_t::OK;
+        if (t.firings)
+        {
+            zero_ratios_.push_back(s.zero_ratio);
+            if (returns)
+                intensities_.push_back(s.mean_intensity);
+        }
+    }
+
+    double median_zero = median(zero_ratios_);
+    double median_intensity = median(intensities_);
+    for (int i = 0; i < LASERS; ++i)
+    {
+        laser_stats_t &s = stats[i];
+        if (totals_[i].firings == 0)
+            continue;
+        if (totals_[i].firings == totals_[i].zeros)
+            s.status = laser_stats_t::DEAD;
+        else if (s.zero_ratio > median_zero + DEGRADED_ZERO_MARGIN
+                 || s.mean_intensity
+                    < DEGRADED_INTENSITY_RATIO * median_intensity)
+            s.status = laser_stats_t::DEGRADED;
+    }
+
+    boost::mutex::scoped_lock lock(lock_);
+    memcpy(stats_, stats, sizeof(stats_));
+    stats_frames_ = frames_;
+}
+
+int LaserHealth::snapshot(laser_stats_t stats[LASERS]) const
+{
+    boost::mutex::scoped_lock lock(lock_);
+    memcpy(stats, stats_, sizeof(stats_));
+    return stats_frames_;
+}
+
+} // namespace pandar_rawdata
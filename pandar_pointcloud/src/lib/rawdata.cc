@@ -26,7 +26,9 @@
  *
  */
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 #include <math.h>
 
 #include <ros/ros.h>
@@ -34,10 +36,20 @@
 #include <angles/angles.h>
 
 #include <pandar_pointcloud/rawdata.h>
+#include <pandar_pointcloud/trace.h>
 
 namespace pandar_rawdata
 {
 
+// the drivers find the frame boundaries and the rotation rate in the
+// raw packets with the layout of pandar_msgs/rotation_rate.h
+static_assert(pandar_msgs::PACKET_BLOCKS == BLOCKS_PER_PACKET &&
+              pandar_msgs::PACKET_BLOCK_SIZE == BLOCK_SIZE &&
+              pandar_msgs::PACKET_AZIMUTH_OFFSET == SOB_ANGLE_SIZE / 2 &&
+              pandar_msgs::PACKET_TIMESTAMP_OFFSET ==
+              BLOCK_SIZE * BLOCKS_PER_PACKET + RESERVE_SIZE + REVOLUTION_SIZE,
+              "raw packet layout differs from pandar_msgs/rotation_rate.h");
+
 static double block_offset[BLOCKS_PER_PACKET];
 static double laser_offset[LASER_COUNT];
 
@@ -49,10 +61,19 @@ static double laser_offset[LASER_COUNT];
 
 RawData::RawData()
 {
-    bufferPacket = new raw_packet_t[1000];
+    bufferPacket = NULL;
     bufferPacketSize = 0;
+    bufferCapacity = 0;
+    resizeBuffer();
+    azimuthStep = 20;                   // 600 rpm
+    discardFrame = false;
+    memset(&frameInfo_, 0, sizeof(frameInfo_));
     lastBlockEnd = 0;
     lastTimestamp = 0;
+    timeBase_ = NULL;
+    dualPolicy_ = DUAL_DEDUPE;
+    firingOutputs_ = 0;
+    memset(&scanBand_, 0, sizeof(scanBand_));
 
     block_offset[5] = 55.1f * 0.0 + 45.18f;
     block_offset[4] = 55.1f * 1.0 + 45.18f;
@@ -157,6 +178,29 @@ int RawData::setup(ros::NodeHandle private_nh)
 
     ROS_INFO_STREAM("Number of lasers: " << calibration_.num_lasers << ".");
 
+    // points kept from the two returns of a dual return firing
+    std::string dualReturn;
+    private_nh.param("dual_return", dualReturn, std::string("dedupe"));
+    if (dualReturn == "both")
+        dualPolicy_ = DUAL_BOTH;
+    else if (dualReturn == "strongest")
+        dualPolicy_ = DUAL_STRONGEST;
+    else if (dualReturn == "last")
+        dualPolicy_ = DUAL_LAST;
+    else
+    {
+        if (dualReturn != "dedupe")
+            ROS_WARN_STREAM("unknown dual_return " << dualReturn
+                            << ", using dedupe");
+        dualPolicy_ = DUAL_DEDUPE;
+    }
+
+    // the rate the frame buffer is sized for, until one is measured
+    double rpm;
+    private_nh.param("rpm", rpm, 600.0);
+    rotation_.reset(rpm);
+    resizeBuffer();
+
     // Set up cached values for sin and cos of all the possible headings
     for (uint16_t rot_index = 0; rot_index < ROTATION_MAX_UNITS; ++rot_index) {
         float rotation = angles::from_degrees(ROTATION_RESOLUTION * rot_index);
@@ -197,6 +241,53 @@ int RawData::setupOffline(std::string calibration_file, double max_range_, doubl
     return 0;
 }
 
+int parseGpsPacket(pandar_msgs::PandarGps &gps, const uint8_t *buf, int len)
+{
+    if (len != GPS_PACKET_SIZE)
+        return -1;
+
+    // two ASCII digits per field, ones digit first
+    int index = 0;
+    gps.flag = (buf[index] & 0xff) | ((buf[index + 1] & 0xff) << 8);
+    index += 2;
+    gps.year = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10;
+    index += 2;
+    gps.month = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10;
+    index += 2;
+    gps.day = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10;
+    index += 2;
+    gps.second = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10;
+    index += 2;
+    gps.minute = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10;
+    index += 2;
+    gps.hour = (buf[index] & 0xff - 0x30) + (buf[index + 1] & 0xff - 0x30) * 10 + 8;
+    index += 2;
+    gps.fineTime = (buf[index] & 0xff) | (buf[index + 1] & 0xff) << 8 |
+                   ((buf[index + 2] & 0xff) << 16) | ((buf[index + 3] & 0xff) << 24);
+    gps.used = 0;
+    return 0;
+}
+
+void updateGps(const pandar_msgs::PandarGps &gps, gps_struct_t &gps2)
+{
+    struct tm t;
+    t.tm_sec = gps.second;
+    t.tm_min = gps.minute;
+    t.tm_hour = gps.hour;
+    t.tm_mday = gps.day;
+    t.tm_mon = gps.month - 1;
+    t.tm_year = gps.year + 2000 - 1900;
+    t.tm_isdst = 0;
+
+    // the gps always is the last gps, the newest GPS data is after the PPS(Serial port transmition speed...)
+    time_t second = mktime(&t) + 1;
+    if (gps2.gps != second)
+    {
+        gps2.gps = second;
+        gps2.used = 0;
+    }
+}
+
 int RawData::parseRawData(raw_packet_t* packet, const uint8_t* buf, const int len)
 {
     if(len != PACKET_SIZE) {
@@ -241,6 +332,21 @@ int RawData::parseRawData(raw_packet_t* packet, const uint8_t* buf, const int le
     packet->factory[0] = buf[index]& 0xff;
     packet->factory[1] = buf[index + 1]& 0xff;
     index += FACTORY_ID_SIZE;
+
+    // the return mode byte says it, else pairs of blocks sharing an
+    // azimuth do
+    if (packet->factory[0] == RETURN_MODE_DUAL)
+        packet->dual = true;
+    else if (packet->factory[0] == RETURN_MODE_STRONGEST
+             || packet->factory[0] == RETURN_MODE_LAST)
+        packet->dual = false;
+    else
+    {
+        packet->dual = true;
+        for (int i = 0; i < BLOCKS_PER_PACKET; i += 2)
+            if (packet->blocks[i].azimuth != packet->blocks[i + 1].azimuth)
+                packet->dual = false;
+    }
     return 0;
 }
 
@@ -345,6 +451,7 @@ void RawData::toPointClouds (raw_packet_t* packet, PPointCloud& pc)
                 continue;
             }
 			// xyzir.ring = j;
+			xyzir.return_index = 0;
 			pc.points.push_back(xyzir);
 			pc.width++;
         }
@@ -388,6 +495,8 @@ void RawData::toPointClouds (raw_packet_t* packet,int block ,  PPointCloud& pc ,
         //         ROS_ERROR("ERROR TIME %lf %lf %f " , cur_time , packet->recv_time , diff);
         //     }
         // }
+            health_.add(i, firing_data.measures[i].range,
+                        firing_data.measures[i].reflectivity);
             PPoint xyzir;
             computeXYZIR (xyzir, firing_data.azimuth,
                     firing_data.measures[i], calibration_.laser_corrections[i]);
@@ -406,8 +515,84 @@ void RawData::toPointClouds (raw_packet_t* packet,int block ,  PPointCloud& pc ,
             
 
             xyzir.ring = i;
+            xyzir.return_index = 0;
             pc.points.push_back(xyzir);
             pc.width++;
+            if (firingOutputs_)
+                addToOutputs(xyzir, firing_data.measures[i].range);
+            if (scanBand_.rings >> i & 1)
+                addToScan(xyzir);
+            if (features_)
+                features_->add(xyzir, firing_data.azimuth);
+    }
+}
+
+/** @brief Convert a dual return firing, blocks @c block and @c block + 1,
+ *  keeping the returns dualPolicy_ asks for.
+ */
+void RawData::toPointCloudsDual(raw_packet_t* packet, int block, PPointCloud& pc,
+                                double stamp, double& firstStamp)
+{
+    int first = 0;
+    const raw_block_t *returns[2] = { &packet->blocks[block],
+                                      &packet->blocks[block + 1] };
+    // three firings per packet, at the times of the last three blocks
+    // of a single return packet
+    double offset = block_offset[BLOCKS_PER_PACKET / 2 + block / 2];
+    for (int i = 0; i < LASER_COUNT; i++) {
+        const raw_measure_t &a = returns[0]->measures[i];
+        const raw_measure_t &b = returns[1]->measures[i];
+        health_.add(i, a.range, a.reflectivity);
+        health_.add(i, b.range, b.reflectivity);
+
+        int keep[2];
+        int count = 0;
+        switch (dualPolicy_)
+        {
+        case DUAL_BOTH:
+            keep[count++] = 0;
+            keep[count++] = 1;
+            break;
+        case DUAL_DEDUPE:
+            keep[count++] = 0;
+            if (b.range != a.range || b.reflectivity != a.reflectivity)
+                keep[count++] = 1;
+            break;
+        case DUAL_STRONGEST:
+            keep[count++] = b.reflectivity > a.reflectivity ? 1 : 0;
+            break;
+        case DUAL_LAST:
+            keep[count++] = b.range > a.range ? 1 : 0;
+            break;
+        }
+
+        for (int k = 0; k < count; ++k) {
+            PPoint xyzir;
+            computeXYZIR (xyzir, returns[keep[k]]->azimuth,
+                    returns[keep[k]]->measures[i], calibration_.laser_corrections[i]);
+            if (pcl_isnan (xyzir.x) || pcl_isnan (xyzir.y) || pcl_isnan (xyzir.z))
+            {
+                continue;
+            }
+
+            xyzir.timestamp = stamp - ((double)(offset + laser_offset[i])/1000000.0f);
+            if(!first)
+            {
+                firstStamp = xyzir.timestamp;
+                first = 1;
+            }
+            xyzir.ring = i;
+            xyzir.return_index = keep[k] + 1;
+            pc.points.push_back(xyzir);
+            pc.width++;
+            if (firingOutputs_)
+                addToOutputs(xyzir, returns[keep[k]]->measures[i].range);
+            if (scanBand_.rings >> i & 1)
+                addToScan(xyzir);
+            // one point per firing along a ring
+            if (features_ && k == 0)
+                features_->add(xyzir, returns[keep[k]]->azimuth);
+        }
     }
 }
 
@@ -424,519 +609,425 @@ void RawData::toPointClouds (raw_packet_t* packet,int laser , int block,  PPoint
                 return;
             }
             // xyzir.ring = laser;
+            xyzir.return_index = 0;
             pc.points.push_back(xyzir);
             pc.width++;
     }
 }
 
-int RawData::unpack(pandar_msgs::PandarPacket &packet, PPointCloud &pc, time_t& gps1 , 
-                                            gps_struct_t &gps2 , double& firstStamp, int& lidarRotationStartAngle)
+void RawData::setOutputs(const std::vector<output_filter_t> &filters)
 {
-    currentPacketStart = bufferPacketSize == 0 ? 0 :bufferPacketSize -1 ;
-
-    parseRawData(&bufferPacket[bufferPacketSize++], &packet.data[0], packet.data.size());
-
-    int hasAframe = 0;
-    int currentBlockEnd = 0;
-    int currentPacketEnd = 0;
-    if(bufferPacketSize > 1)
+    outputs_.clear();
+    for (size_t n = 0; n < filters.size() && n < 64; ++n)
     {
-        int lastAzumith = -1;
-        for(int i = currentPacketStart ; i < bufferPacketSize ; i++)
-        {
-            if(hasAframe)
-            {
-                break;
-            }
-
-            int j = 0;
-            if (i == currentPacketStart)
-            {
-                /* code */
-                j = lastBlockEnd;
-            }
-            else
-            {
-                j = 0;
-            }
-            for (; j < BLOCKS_PER_PACKET; ++j)
-            {
-                /* code */
-                if(lastAzumith == -1)
-                {
-                    lastAzumith = bufferPacket[i].blocks[j].azimuth;
-                    continue;
-                }
-
+        Output output;
+        output.filter = filters[n];
+        if (output.filter.decimation < 1)
+            output.filter.decimation = 1;
+        output.cloud.reset(new PPointCloud());
+        outputs_.push_back(output);
+    }
+    if (filters.size() > outputs_.size())
+        ROS_WARN("only %zu of %zu outputs are filled", outputs_.size(),
+                 filters.size());
+    firingOutputs_ = 0;
+}
 
-                if(lastAzumith > bufferPacket[i].blocks[j].azimuth)
-                {
-                    if (lidarRotationStartAngle <= bufferPacket[i].blocks[j].azimuth)
-                    {
-                        // ROS_ERROR("rotation, %d, %d, %d", lastAzumith, bufferPacket[i].blocks[j].azimuth, lidarRotationStartAngle);
-                        currentBlockEnd = j;
-                        hasAframe = 1;
-                        currentPacketEnd = i;
-                        break;
-                    }
+PPointCloud::Ptr RawData::takeOutput(size_t output)
+{
+    PPointCloud::Ptr cloud = outputs_[output].cloud;
+    outputs_[output].cloud.reset(new PPointCloud());
+    outputs_[output].cloud->points.reserve(cloud->points.size());
+    return cloud;
+}
 
-                }
-                else if (lastAzumith < lidarRotationStartAngle && lidarRotationStartAngle <= bufferPacket[i].blocks[j].azimuth)
-                {
-                    // ROS_ERROR("%d, %d, %d", lastAzumith, bufferPacket[i].blocks[j].azimuth, lidarRotationStartAngle);
-                    currentBlockEnd = j;
-                    hasAframe = 1;
-                    currentPacketEnd = i;
-                    break;
-                }
-                lastAzumith = bufferPacket[i].blocks[j].azimuth;
-            }
-        }
+/** @brief Pick the outputs that keep the firing at @c azimuth, the
+ *  @c firing th of the frame, before converting it.
+ */
+void RawData::selectOutputs(int azimuth, int firing)
+{
+    firingOutputs_ = 0;
+    for (size_t n = 0; n < outputs_.size(); ++n)
+    {
+        const output_filter_t &f = outputs_[n].filter;
+        if (firing % f.decimation != 0)
+            continue;
+        if (f.min_azimuth != f.max_azimuth
+            && (azimuth - f.min_azimuth + 36000) % 36000
+               > (f.max_azimuth - f.min_azimuth + 36000) % 36000)
+            continue;
+        firingOutputs_ |= 1ULL << n;
     }
+}
 
-    if(hasAframe)
+/** @brief Add a point converted into the main cloud to the outputs
+ *  selected for its firing that keep its ring and range.
+ */
+void RawData::addToOutputs(const PPoint &point, uint32_t range)
+{
+    double distanceM = range * 0.002;
+    for (size_t n = 0; n < outputs_.size(); ++n)
     {
+        if (!(firingOutputs_ >> n & 1))
+            continue;
+        const output_filter_t &f = outputs_[n].filter;
+        if (!(f.rings >> point.ring & 1)
+            || distanceM < f.min_range || distanceM > f.max_range)
+            continue;
+        PPointCloud &cloud = *outputs_[n].cloud;
+        cloud.points.push_back(point);
+        cloud.width++;
+    }
+}
 
-        int first = 0;
-        int j = 0;
-        for (int k = 0; k < (currentPacketEnd + 1); ++k)
-        {
-            if(k == 0)
-                j = lastBlockEnd;
-            else
-                j = 0;
+void RawData::setScanBand(const scan_band_t &band)
+{
+    scanBand_ = band;
+    if (scanBand_.bins < 1)
+        scanBand_.rings = 0;
+    if (!scanBand_.rings)
+        scanBand_.bins = 0;
+    scanRanges_.assign(scanBand_.bins, std::numeric_limits<float>::infinity());
+    scanIntensities_.assign(scanBand_.bins, 0.0f);
+}
 
-            
+void RawData::takeScan(std::vector<float> &ranges, std::vector<float> &intensities)
+{
+    // the arrays stay allocated: the next frame clears them in place
+    ranges.assign(scanRanges_.begin(), scanRanges_.end());
+    intensities.assign(scanIntensities_.begin(), scanIntensities_.end());
+}
 
-            // if > 500ms 
-            if(bufferPacket[k].timestamp < 500000 && gps2.used == 0)
-            {
-                if(gps1 > gps2.gps)
-                {
-                    ROS_ERROR("Oops , You give me a wrong timestamp I think...");
-                }
-                gps1 = gps2.gps;
-                gps2.used =1;
-            }
-            else
-            {
-                if(bufferPacket[k].timestamp < lastTimestamp)
-                {
-                    int gap = (int)lastTimestamp - (int)bufferPacket[k].timestamp;
-                    // avoid the fake jump... wrong udp order
-                    if(gap > (10 * 1000)) // 10ms
-                    {
-                        // Oh , there is a round. But gps2 is not changed , So there is no gps packet!!!
-                        // We need to add the offset.
-                        
-                        gps1 += ((lastTimestamp-20) /1000000) +  1; // 20us offset , avoid the timestamp of 1000002...
-                        ROS_ERROR("There is a round , But gps packet!!! , Change gps1 by manual!!! %d %d %d " , gps1 , lastTimestamp , bufferPacket[k].timestamp);
-                    }
-                    
-                }
-            }
-            int timestamp = bufferPacket[k].timestamp;
-
-
-            // int gap = timestamp - lastTimestamp;
-            // gap = gap <0 ? gap + 1000000 : gap;
-            // if(gap > 600)
-            // {
-            //     ROS_ERROR("gap too large %d-%d=%d"  , timestamp ,lastTimestamp , gap);
-            // }
-            // ROS_ERROR("timestamp : %d %lf %d"  , timestamp ,ros::Time::now().toSec() , gps1);
-            // ROS_ERROR("timestamp of this packe t : %lf" ,(double)gps1 + (((double)bufferPacket[k].timestamp)/1000000));
-            for (; j < BLOCKS_PER_PACKET; ++j)
-            {
-                /* code */
-                if (currentBlockEnd == j && k == (currentPacketEnd))
-                {
-                    break;
-                }
-                double stamp = 0.0;
-                toPointClouds(&bufferPacket[k] , j, pc ,(double)gps1 + (((double)bufferPacket[k].timestamp)/1000000) , stamp);
-                if(!first && stamp != 0.0)
-                {
-                    firstStamp = stamp;
-                    first = 1;
-                }
-                
-            } 
-            lastTimestamp = bufferPacket[k].timestamp;
-        }
-        memcpy(&bufferPacket[0] , &bufferPacket[currentPacketEnd] , sizeof(raw_packet_t) * (bufferPacketSize - currentPacketEnd));
-        bufferPacketSize = bufferPacketSize - currentPacketEnd;
-        lastBlockEnd = currentBlockEnd;
-        return 1;
-    }
-    else
+/** @brief Keep a point of the scan rings if it is the nearest of its bin. */
+void RawData::addToScan(const PPoint &point)
+{
+    float range = sqrtf(point.x * point.x + point.y * point.y);
+    if (range < scanBand_.min_range || range > scanBand_.max_range)
+        return;
+    int bin = int((atan2f(point.y, point.x) + M_PI) * scanBand_.bins / (2 * M_PI));
+    if (bin >= scanBand_.bins)
+        bin = 0;                         // +pi is -pi
+    if (range < scanRanges_[bin])
     {
-        return 0;
+        scanRanges_[bin] = range;
+        scanIntensities_[bin] = point.intensity;
     }
 }
 
-int RawData::unpack(const pandar_msgs::PandarScan::ConstPtr &scanMsg, PPointCloud &pc , time_t& gps1 , 
-    gps_struct_t &gps2 , double& firstStamp, int& lidarRotationStartAngle)
+void RawData::setFeatures(const feature_config_t &config)
 {
-    currentPacketStart = bufferPacketSize == 0 ? 0 :bufferPacketSize -1 ;
-    for (int i = 0; i < scanMsg->packets.size(); ++i)
-    {
-        /* code */
-        parseRawData(&bufferPacket[bufferPacketSize++], &scanMsg->packets[i].data[0], scanMsg->packets[i].data.size());
-        bufferPacket[bufferPacketSize - 1].recv_time = scanMsg->packets[i].stamp.toSec();
+    features_.reset(new FeatureExtractor(config));
+}
 
-        // int agap = (int)bufferPacket[bufferPacketSize - 1].blocks[0].azimuth - lastAzumith;
-        // agap = agap < 0 ? agap + 36000 : agap;
-        // if(agap > 130)
-        // {
-        //     ROS_ERROR("azimuth gap is too large %d-%d=%d" , bufferPacket[bufferPacketSize - 1].blocks[0].azimuth , lastAzumith,agap);
-        // }
-        // lastAzumith = bufferPacket[bufferPacketSize - 1].blocks[0].azimuth;
-    }
-    
-    // ROS_ERROR("currentPacketStart %d bufferPacketSize %d " , currentPacketStart , bufferPacketSize);
-    int hasAframe = 0;
-    int currentBlockEnd = 0;
-    int currentPacketEnd = 0;
-    if(bufferPacketSize > 1)
-    {
-        int lastAzumith = -1;
-        for(int i = currentPacketStart ; i < bufferPacketSize ; i++)
-        {
-            if(hasAframe)
-            {
-                break;
-            }
+void RawData::reset()
+{
+    bufferPacketSize = 0;
+    lastBlockEnd = 0;
+    discardFrame = true;
+}
 
-            int j = 0;
-            if (i == currentPacketStart)
-            {
-                /* code */
-                j = lastBlockEnd;
-            }
-            else
-            {
-                j = 0;
-            }
-            for (; j < BLOCKS_PER_PACKET; ++j)
-            {
-                /* code */
-                if(lastAzumith == -1)
-                {
-                    lastAzumith = bufferPacket[i].blocks[j].azimuth;
-                    continue;
-                }
+/** @brief Make room for @c count more packets in bufferPacket.
+ *
+ *  Without a frame boundary the buffer would grow forever, for
+ *  instance when the device stops rotating: drop what it holds.  The
+ *  frame they started is incomplete, and is discarded at the next
+ *  boundary.
+ */
+void RawData::reserveBuffer(int count)
+{
+    if (bufferPacketSize + count <= bufferCapacity)
+        return;
 
+    ROS_WARN("no frame boundary in %d packets, dropping them", bufferPacketSize);
+    reset();
+}
 
-                if(lastAzumith > bufferPacket[i].blocks[j].azimuth)
-                {
-                    if (lidarRotationStartAngle <= bufferPacket[i].blocks[j].azimuth)
-                    {
-                        // ROS_ERROR("rotation, %d, %d, %d", lastAzumith, bufferPacket[i].blocks[j].azimuth, lidarRotationStartAngle);
-                        currentBlockEnd = j;
-                        hasAframe = 1;
-                        currentPacketEnd = i;
-                        break;
-                    }
+/** @brief Size bufferPacket for the packets per revolution measured,
+ *  keeping the packets it holds.
+ */
+void RawData::resizeBuffer()
+{
+    int capacity = BUFFER_REVOLUTIONS * rotation_.packetsPerRevolution()
+                   + BUFFER_MARGIN;
+    if (capacity < bufferPacketSize)
+        capacity = bufferPacketSize;
+    if (capacity == bufferCapacity)
+        return;
 
-                }
-                else if (lastAzumith < lidarRotationStartAngle && lidarRotationStartAngle <= bufferPacket[i].blocks[j].azimuth)
-                {
-                    // ROS_ERROR("%d, %d, %d", lastAzumith, bufferPacket[i].blocks[j].azimuth, lidarRotationStartAngle);
-                    currentBlockEnd = j;
-                    hasAframe = 1;
-                    currentPacketEnd = i;
-                    break;
-                }
-                lastAzumith = bufferPacket[i].blocks[j].azimuth;
-            }
-        }
-    }
+    raw_packet_t *buffer = new raw_packet_t[capacity];
+    if (bufferPacketSize > 0)
+        memcpy(buffer, bufferPacket, sizeof(raw_packet_t) * bufferPacketSize);
+    delete[] bufferPacket;
+    bufferPacket = buffer;
+    bufferCapacity = capacity;
+}
 
-    if(hasAframe)
+/** @brief Learn the azimuth step between blocks from a new packet.
+ *
+ *  Blocks of one packet are never lost separately, so their spacing
+ *  is the true step even when packets are.  Blocks with the same
+ *  azimuth (dual return) are skipped.
+ */
+void RawData::updateAzimuthStep(const raw_packet_t &packet)
+{
+    for (int j = 1; j < BLOCKS_PER_PACKET; ++j)
     {
-#if 0
-        for(int i = 0 ; i < LASER_COUNT ; i++)
+        int step = ((int) packet.blocks[j].azimuth
+                    - (int) packet.blocks[j - 1].azimuth + 36000) % 36000;
+        if (step > 0 && step < 1000)
         {
-            if(PandarEnableList[i] == 1)
-            {
-                int j = 0;
-                for (int k = 0; k < (currentPacketEnd + 1); ++k)
-                {
-                    if(k == 0)
-                        j = lastBlockEnd;
-                    else
-                        j = 0;
-                    
-                    for (; j < BLOCKS_PER_PACKET; ++j)
-                    {
-                        /* code */
-                        if (currentBlockEnd == j && k == (currentPacketEnd))
-                        {
-                            break;
-                        }
-                        toPointClouds(&bufferPacket[k] , i , j, pc);
-                        
-                    } 
-                }
-            }
-        }
-#else
-        int first = 0;
-        int j = 0;
-        for (int k = 0; k < (currentPacketEnd + 1); ++k)
-        {
-            if(k == 0)
-                j = lastBlockEnd;
-            else
-                j = 0;
-
-            
-
-            // if > 500ms 
-            if(bufferPacket[k].timestamp < 500000 && gps2.used == 0)
-            {
-                if(gps1 > gps2.gps)
-                {
-                    ROS_ERROR("Oops , You give me a wrong timestamp I think...");
-                }
-                gps1 = gps2.gps;
-                gps2.used =1;
-            }
-            else
-            {
-                if(bufferPacket[k].timestamp < lastTimestamp)
-                {
-                    int gap = (int)lastTimestamp - (int)bufferPacket[k].timestamp;
-                    // avoid the fake jump... wrong udp order
-                    if(gap > (10 * 1000)) // 10ms
-                    {
-                        // Oh , there is a round. But gps2 is not changed , So there is no gps packet!!!
-                        // We need to add the offset.
-                        
-                        gps1 += ((lastTimestamp-20) /1000000) +  1; // 20us offset , avoid the timestamp of 1000002...
-                        // ROS_ERROR("There is a round , But gps packet!!! , Change gps1 by manual!!! %d %d %d " , gps1 , lastTimestamp , bufferPacket[k].timestamp);
-                    }
-                    
-                }
-            }
-            int timestamp = bufferPacket[k].timestamp;
-
-
-            // int gap = timestamp - lastTimestamp;
-            // gap = gap <0 ? gap + 1000000 : gap;
-            // if(gap > 600)
-            // {
-            //     ROS_ERROR("gap too large %d-%d=%d"  , timestamp ,lastTimestamp , gap);
-            // }
-            // ROS_ERROR("timestamp : %d %lf %d"  , timestamp ,ros::Time::now().toSec() , gps1);
-            // ROS_ERROR("timestamp of this packe t : %lf" ,(double)gps1 + (((double)bufferPacket[k].timestamp)/1000000));
-            for (; j < BLOCKS_PER_PACKET; ++j)
-            {
-                /* code */
-                if (currentBlockEnd == j && k == (currentPacketEnd))
-                {
-                    break;
-                }
-                double stamp = 0.0;
-                toPointClouds(&bufferPacket[k] , j, pc ,(double)gps1 + (((double)bufferPacket[k].timestamp)/1000000) , stamp);
-                if(!first && stamp != 0.0)
-                {
-                    firstStamp = stamp;
-                    first = 1;
-                }
-                
-            } 
-            lastTimestamp = bufferPacket[k].timestamp;
+            azimuthStep = step;
+            return;
         }
-#endif
-        memcpy(&bufferPacket[0] , &bufferPacket[currentPacketEnd] , sizeof(raw_packet_t) * (bufferPacketSize - currentPacketEnd));
-        bufferPacketSize = bufferPacketSize - currentPacketEnd;
-        lastBlockEnd = currentBlockEnd;
-
-        // for(int i = 0 ; i < LASER_COUNT ; i++)
-        // {
-        //     if(PandarEnableList[i] == 1)
-        //     {
-        //         pc.height++;
-        //     }
-        // }
-
-        // pc.width /= pc.height;
-        // if(pc.width > 1900 || pc.width < 1700)
-        // {
-        //     ROS_INFO("This fram ");
-        // }
-
-        return 1;
     }
-    else
+}
+
+/** @brief Look for the end of a frame in the buffered packets.
+ *
+ *  The scan starts with the last packet of the previous call, so the
+ *  step between it and the new packets is seen.  A frame ends where
+ *  the rotation crosses @c lidarRotationStartAngle.  A packet that
+ *  arrives late steps backwards by much less than a turn: it does not
+ *  end the frame, nor can it make the next packet cross the start
+ *  angle a second time.
+ *
+ *  @returns 1 with the packet and block that start the next frame,
+ *           0 if the frame goes on
+ */
+int RawData::findFrameEnd(int lidarRotationStartAngle,
+                          int &currentPacketEnd, int &currentBlockEnd)
+{
+    if(bufferPacketSize <= 1)
     {
         return 0;
     }
 
-
-#if 0
-    raw_packet_t *packets = new raw_packet_t[scanMsg->packets.size()];
-
-    int lastAzumith = -1;
-    int currentPacketEnd = 0;
-    int currentBlockEnd = 0;
-    raw_packet_t *currentPacket = NULL;
-
-    int currentAvariableBlock = 0;
-
-    int foundTheGap = 0;
-    // process each packet provided by the driver
-    for (size_t i = 0; i < scanMsg->packets.size(); ++i)
+    int lastAzimuth = -1;
+    for(int i = currentPacketStart ; i < bufferPacketSize ; i++)
     {
-        
-        parseRawData(&packets[i], &scanMsg->packets[i].data[0], scanMsg->packets[i].data.size());
-
-        if(foundTheGap)
-            continue;
-
-        for(size_t j = 0 ; j < BLOCKS_PER_PACKET ; j++)
+        int j = (i == currentPacketStart) ? lastBlockEnd : 0;
+        for (; j < BLOCKS_PER_PACKET; ++j)
         {
-            if(lastAzumith == -1)
+            if (pandar_msgs::crossesStartAngle(lastAzimuth,
+                                               bufferPacket[i].blocks[j].azimuth,
+                                               lidarRotationStartAngle))
             {
-                lastAzumith = packets[i].blocks[j].azimuth;
-                continue;
-            }
-
-            if(lastAzumith > packets[i].blocks[j].azimuth)
-            {
-                // a frame;
-                if(i != (scanMsg->packets.size() - 1))
-                {
-                    if(j ==  (BLOCKS_PER_PACKET-1))
-                    {
-                        currentPacketEnd = i+1;
-                        currentBlockEnd = 0;
-                    }
-                    else
-                    {
-                        currentPacketEnd = i;
-                        currentBlockEnd = j+1;
-                    }
-
-                    currentPacket = packets;
-                }
-                else
-                {
-                    if(j ==  (BLOCKS_PER_PACKET-1))
-                    {
-                        currentPacket = NULL;
-                        currentPacketEnd = 0;
-                        currentBlockEnd = 0;
-                    }
-                    else
-                    {
-                        currentPacketEnd = i;
-                        currentBlockEnd = j+1;
-                        currentPacket = packets;
-                    }
-                }
-                foundTheGap = 1;
-                break;
+                currentBlockEnd = j;
+                currentPacketEnd = i;
+                return 1;
             }
-
-            currentAvariableBlock++;
         }
     }
+    return 0;
+}
 
-    // ROS_ERROR("dddd  %d %d " , currentPacketEnd , currentBlockEnd);
-#if 1
-    if(lastPacket)
+/** @brief Convert the buffered blocks before the end of the frame,
+ *  and keep the packet holding the first blocks of the next one.
+ */
+void RawData::assembleFrame(PPointCloud &pc, time_t& gps1, gps_struct_t &gps2,
+                            double& firstStamp, int currentPacketEnd,
+                            int currentBlockEnd)
+{
+    PANDAR_TRACE2(frame_boundary, currentPacketEnd + 1, currentBlockEnd);
+    PANDAR_TRACE1(convert_start, currentPacketEnd + 1);
+
+    frame_info_t info;
+    info.blocks = 0;
+    info.missing_blocks = 0;
+    info.reordered_blocks = 0;
+    info.azimuth_step = azimuthStep;
+    int previousAzimuth = -1;
+    // outputs not taken since the last frame start over
+    for (size_t n = 0; n < outputs_.size(); ++n)
+        outputs_[n].cloud->clear();
+    if (scanBand_.rings)
     {
-        int first = 1;
-        int j = 0;
+        std::fill(scanRanges_.begin(), scanRanges_.end(),
+                  std::numeric_limits<float>::infinity());
+        std::fill(scanIntensities_.begin(), scanIntensities_.end(), 0.0f);
+    }
 
-        for(int i = 0 ; i < LASER_COUNT ; i++)
+    int first = 0;
+    int j = 0;
+    for (int k = 0; k < (currentPacketEnd + 1); ++k)
+    {
+        if(k == 0)
+            j = lastBlockEnd;
+        else
+            j = 0;
+
+        time_t second = timeBase_ ?
+            timeBase_->second(bufferPacket[k].timestamp, bufferPacket[k].recv_time) : -1;
+        if (second >= 0)
+        {
+            // the time base decides the rollovers of every sensor
+            gps1 = second;
+        }
+        // if > 500ms
+        else if(bufferPacket[k].timestamp < 500000 && gps2.used == 0)
         {
-            if(PandarEnableList[i] == 1)
+            if(gps1 > gps2.gps)
             {
-                for (int k = lastPacketEnd; k < lastPacketCounter; ++k)
+                ROS_ERROR("Oops , You give me a wrong timestamp I think...");
+            }
+            gps1 = gps2.gps;
+            gps2.used =1;
+        }
+        else
+        {
+            if(bufferPacket[k].timestamp < lastTimestamp)
+            {
+                int gap = (int)lastTimestamp - (int)bufferPacket[k].timestamp;
+                // avoid the fake jump... wrong udp order
+                if(gap > (10 * 1000)) // 10ms
                 {
-                    if(k == lastPacketEnd)
-                        j = lastBlockEnd;
-                    else
-                        j = 0;
-                    
-                    for (; j < BLOCKS_PER_PACKET; ++j)
-                    {
-                        /* code */
-                        toPointClouds(&lastPacket[k] , i , j, pc);
-                        pc.width++;
-                    } 
+                    // Oh , there is a round. But gps2 is not changed , So there is no gps packet!!!
+                    // We need to add the offset.
+
+                    gps1 += ((lastTimestamp-20) /1000000) +  1; // 20us offset , avoid the timestamp of 1000002...
+                    ROS_ERROR("There is a round , But gps packet!!! , Change gps1 by manual!!! %d %d %d " , gps1 , lastTimestamp , bufferPacket[k].timestamp);
                 }
+
             }
         }
-    }
-#endif
 
-    // // if(lastPacket && packets[0].blocks[0].azimuth < lastPacket[lastPacketCounter-1].blocks[BLOCKS_PER_PACKET -1].azimuth)
-    // // {
-    // // }
-    // else
-    {
-        for(int i = 0 ; i < LASER_COUNT ; i++)
+        for (; j < BLOCKS_PER_PACKET; ++j)
         {
-            if(PandarEnableList[i] != 1)
+            if (currentBlockEnd == j && k == (currentPacketEnd))
             {
+                break;
+            }
+
+            // the second return is converted with the first
+            bool dual = bufferPacket[k].dual;
+            if (dual && j % 2 == 1)
                 continue;
+
+            // count the blocks lost in gaps, and those out of order
+            int azimuth = bufferPacket[k].blocks[j].azimuth;
+            if (previousAzimuth >= 0)
+            {
+                int delta = (azimuth - previousAzimuth + 36000) % 36000;
+                if (delta > 18000)
+                    info.reordered_blocks++;
+                else if (delta * 2 > azimuthStep * 3)
+                    info.missing_blocks += (delta + azimuthStep / 2) / azimuthStep - 1;
             }
-            for (int k = 0; k <= currentPacketEnd; ++k)
+            previousAzimuth = azimuth;
+            info.blocks++;
+            if (!outputs_.empty())
+                selectOutputs(azimuth, info.blocks - 1);
+
+            double stamp = 0.0;
+            double packetStamp = (double)gps1 + (((double)bufferPacket[k].timestamp)/1000000);
+            if (dual)
+                toPointCloudsDual(&bufferPacket[k], j, pc, packetStamp, stamp);
+            else
+                toPointClouds(&bufferPacket[k] , j, pc , packetStamp , stamp);
+            if(!first && stamp != 0.0)
             {
-                for (int j = 0; j < BLOCKS_PER_PACKET; ++j)
-                {
-                    if(k == currentPacketEnd && j == currentBlockEnd)
-                        break;
-                    /* code */
-                    toPointClouds(&packets[k] , i , j, pc);
-                    pc.width++;
-                }
-                
+                firstStamp = stamp;
+                first = 1;
             }
         }
+        lastTimestamp = bufferPacket[k].timestamp;
     }
+    PANDAR_TRACE1(convert_end, pc.points.size());
+    health_.endFrame();
+    if (features_)
+        features_->endFrame();
+
+    info.expected_blocks = (36000 + azimuthStep - 1) / azimuthStep;
+    info.coverage = info.blocks >= info.expected_blocks ?
+                    1.0 : double(info.blocks) / info.expected_blocks;
+    info.rpm = rotation_.rpm();
+    frameInfo_ = info;
+
+    memmove(&bufferPacket[0] , &bufferPacket[currentPacketEnd] , sizeof(raw_packet_t) * (bufferPacketSize - currentPacketEnd));
+    bufferPacketSize = bufferPacketSize - currentPacketEnd;
+    lastBlockEnd = currentBlockEnd;
+}
 
+/** @brief Drop the buffered blocks before the frame boundary, what
+ *  was left of a frame after reset().
+ */
+void RawData::discardPartialFrame(int currentPacketEnd, int currentBlockEnd)
+{
+    memmove(&bufferPacket[0] , &bufferPacket[currentPacketEnd] , sizeof(raw_packet_t) * (bufferPacketSize - currentPacketEnd));
+    bufferPacketSize = bufferPacketSize - currentPacketEnd;
+    lastBlockEnd = currentBlockEnd;
+    discardFrame = false;
+}
+
+bool RawData::measureRotation(const pandar_msgs::PandarPacket &packet)
+{
+    if (!rotation_.add(packet))
+        return false;
+    resizeBuffer();
+    return true;
+}
 
-#if 1
+/** @brief Buffer a packet, and assemble the frame it may end.
+ *
+ *  @returns 1 if a frame was assembled in @c pc, 0 otherwise
+ */
+int RawData::addPacket(const pandar_msgs::PandarPacket &packet, PPointCloud &pc,
+                       time_t& gps1, gps_struct_t &gps2, double& firstStamp,
+                       int lidarRotationStartAngle)
+{
+    reserveBuffer(1);
+    // a malformed packet takes no slot: its azimuths are garbage
+    if (parseRawData(&bufferPacket[bufferPacketSize], &packet.data[0],
+                     packet.data.size()) != 0)
+        return 0;
+    currentPacketStart = bufferPacketSize == 0 ? 0 :bufferPacketSize -1 ;
+    bufferPacketSize++;
+    bufferPacket[bufferPacketSize - 1].recv_time = packet.stamp.toSec();
+    updateAzimuthStep(bufferPacket[bufferPacketSize - 1]);
+    if (rotation_.add(bufferPacket[bufferPacketSize - 1].blocks[0].azimuth,
+                      bufferPacket[bufferPacketSize - 1].timestamp))
+        resizeBuffer();
 
-    for(int i = 0 ; i < LASER_COUNT ; i++)
+    int currentBlockEnd = 0;
+    int currentPacketEnd = 0;
+    if(findFrameEnd(lidarRotationStartAngle, currentPacketEnd, currentBlockEnd))
     {
-        if(PandarEnableList[i] == 1)
+        if(discardFrame)
         {
-            pc.height++;
+            discardPartialFrame(currentPacketEnd, currentBlockEnd);
+            return 0;
         }
+        assembleFrame(pc, gps1, gps2, firstStamp, currentPacketEnd, currentBlockEnd);
+        return 1;
     }
+    return 0;
+}
 
-    pc.width /= pc.height;
-    if(pc.width > 1900 || pc.width < 1700)
-    {
-        ROS_ERROR("SSS %d %d  , %d %d " , currentPacketEnd , currentBlockEnd , lastPacketEnd ,lastBlockEnd);
-    }
-
-    if(lastPacket)
-    {
-        delete [] lastPacket;
-        lastPacket = NULL;
-    }
+int RawData::unpack(pandar_msgs::PandarPacket &packet, PPointCloud &pc, time_t& gps1 , 
+                                            gps_struct_t &gps2 , double& firstStamp, int& lidarRotationStartAngle)
+{
+    return addPacket(packet, pc, gps1, gps2, firstStamp, lidarRotationStartAngle);
+}
 
-    if(currentPacket)
+/** @brief Unpack the packets of a scan from @c next on, up to the first
+ *  frame they end.
+ *
+ *  A scan may end more than one frame: call again, with @c next as
+ *  returned, until it reaches the end of the scan.
+ *
+ *  @returns 1 if a frame was assembled in @c pc, 0 at the end of the scan
+ */
+int RawData::unpack(const pandar_msgs::PandarScan &scan, size_t &next, PPointCloud &pc,
+                    time_t& gps1 , gps_struct_t &gps2 , double& firstStamp,
+                    int lidarRotationStartAngle)
+{
+    while (next < scan.packets.size())
     {
-        lastPacket = currentPacket;
-        lastPacketEnd = currentPacketEnd;
-        lastBlockEnd = currentBlockEnd;
-        lastPacketCounter = scanMsg->packets.size();
+        if (addPacket(scan.packets[next++], pc, gps1, gps2, firstStamp,
+                      lidarRotationStartAngle))
+            return 1;
     }
-
-#else
-    lastPacket = NULL;
-    delete [] packets;
-#endif
-#endif
+    return 0;
 }
 
 /** @brief convert raw packet to point cloud
@@ -949,7 +1040,8 @@ void RawData::unpack(const pandar_msgs::PandarPacket &pkt, PPointCloud &pc)
     ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
 
 	raw_packet_t packet;
-	parseRawData(&packet, &pkt.data[0], pkt.data.size());
+	if (parseRawData(&packet, &pkt.data[0], pkt.data.size()) != 0)
+	    return;
 	toPointClouds(&packet, pc);
 }
 
@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  Shared memory transport of Pandar40 point clouds.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <pandar_pointcloud/shm_ring.h>
+
+namespace pandar_pointcloud
+{
+using pandar_rawdata::PPoint;
+using pandar_rawdata::PPointCloud;
+
+static const size_t HEADER_SIZE = 64;
+
+static size_t align64(size_t n)
+{
+    return (n + 63) & ~(size_t) 63;
+}
+
+static int futexWake(uint32_t *addr)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int futexWait(const uint32_t *addr, uint32_t value, double timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) timeout;
+    ts.tv_nsec = (long) ((timeout - ts.tv_sec) * 1e9);
+    return syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static double monotonicNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+////////////////////////////////////////////////////////////////////////
+// ShmRingWriter
+////////////////////////////////////////////////////////////////////////
+
+ShmRingWriter::ShmRingWriter():
+    base_(NULL), size_(0), sequence_(0)
+{}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    close();
+}
+
+int ShmRingWriter::open(const std::string &name, uint32_t slots,
+                        uint32_t max_points)
+{
+    if (slots == 0 || max_points == 0)
+        return EINVAL;
+    close();
+
+    // a previous segment may have another geometry, readers still
+    // mapping it keep it alive until they reopen
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return errno;
+
+    uint64_t stride = align64(sizeof(shm_slot_header_t)
+                              + (uint64_t) max_points * sizeof(PPoint));
+    size_t size = HEADER_SIZE + slots * stride;
+    if (ftruncate(fd, size) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return err;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+    {
+        int err = errno;
+        shm_unlink(name.c_str());
+        return err;
+    }
+
+    name_ = name;
+    base_ = (uint8_t *) base;
+    size_ = size;
+    sequence_ = 0;
+
+    shm_ring_header_t *header = (shm_ring_header_t *) base_;
+    header->version = SHM_RING_VERSION;
+    header->slots = slots;
+    header->max_points = max_points;
+    header->point_size = sizeof(PPoint);
+    header->futex = 0;
+    header->slot_stride = stride;
+    header->sequence = 0;
+    // readers check the magic last
+    __atomic_store_n(&header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ShmRingWriter::close()
+{
+    if (base_)
+    {
+        munmap(base_, size_);
+        shm_unlink(name_.c_str());
+    }
+    base_ = NULL;
+    size_ = 0;
+}
+
+uint64_t ShmRingWriter::write(const PPointCloud &pc, uint32_t &slot)
+{
+    shm_ring_header_t *header = (shm_ring_header_t *) base_;
+    if (base_ == NULL || pc.points.size() > header->max_points)
+        return 0;
+
+    uint64_t sequence = ++sequence_;
+    slot = sequence % header->slots;
+    uint8_t *p = base_ + HEADER_SIZE + slot * header->slot_stride;
+    shm_slot_header_t *s = (shm_slot_header_t *) p;
+
+    // odd while writing, then twice the sequence number
+    __atomic_store_n(&s->lock, 2 * sequence - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->sequence = sequence;
+    s->stamp = pc.header.stamp;
+    s->points = pc.points.size();
+    strncpy(s->frame_id, pc.header.frame_id.c_str(), sizeof(s->frame_id) - 1);
+    s->frame_id[sizeof(s->frame_id) - 1] = '\0';
+    if (!pc.points.empty())
+        memcpy(p + sizeof(shm_slot_header_t), &pc.points[0],
+               pc.points.size() * sizeof(PPoint));
+
+    __atomic_store_n(&s->lock, 2 * sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&header->futex, 1, __ATOMIC_RELEASE);
+    futexWake(&header->futex);
+    return sequence;
+}
+
+////////////////////////////////////////////////////////////////////////
+// ShmRingReader
+////////////////////////////////////////////////////////////////////////
+
+ShmRingReader::ShmRingReader():
+    base_(NULL), size_(0), last_sequence_(0), missed_(0)
+{}
+
+ShmRingReader::~ShmRingReader()
+{
+    close();
+}
+
+int ShmRingReader::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < HEADER_SIZE)
+    {
+        ::close(fd);
+        return EAGAIN;                  // writer still setting it up
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+        return errno;
+
+    const shm_ring_header_t *header = (const shm_ring_header_t *) base;
+    int err = 0;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC)
+        err = EAGAIN;
+    else if (header->version != SHM_RING_VERSION
+             || header->point_size != sizeof(PPoint)
+             || HEADER_SIZE + header->slots * header->slot_stride
+                > (uint64_t) st.st_size)
+        err = EPROTO;
+    if (err)
+    {
+        munmap(base, st.st_size);
+        return err;
+    }
+
+    base_ = (const uint8_t *) base;
+    size_ = st.st_size;
+    // only frames written from now on are new
+    last_sequence_ = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void ShmRingReader::close()
+{
+    if (base_)
+        munmap((void *) base_, size_);
+    base_ = NULL;
+    size_ = 0;
+}
+
+int ShmRingReader::read(PPointCloud &pc, double timeout, uint64_t *sequence)
+{
+    if (base_ == NULL)
+        return EBADF;
+    const shm_ring_header_t *header = (const shm_ring_header_t *) base_;
+
+    // wait for a frame newer than the last one read
+    double deadline = monotonicNow() + timeout;
+    uint64_t seq;
+    while (true)
+    {
+        uint32_t futex = __atomic_load_n(&header->futex, __ATOMIC_ACQUIRE);
+        seq = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if (seq != last_sequence_)
+            break;
+        double left = deadline - monotonicNow();
+        if (left <= 0.0)
+            return ETIMEDOUT;
+        futexWait(&header->futex, futex, left);
+    }
+
+    // copy the newest frame; if the writer laps us, start again
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        const uint8_t *p = base_ + HEADER_SIZE
+                           + (seq % header->slots) * header->slot_stride;
+        const shm_slot_header_t *s = (const shm_slot_header_t *) p;
+
+        uint64_t lock = __atomic_load_n(&s->lock, __ATOMIC_ACQUIRE);
+        if (lock == 2 * seq)
+        {
+            uint32_t points = s->points;
+            if (points > header->max_points)
+                points = header->max_points;
+            pc.points.resize(points);
+            if (points)
+                memcpy(&pc.points[0], p + sizeof(shm_slot_header_t),
+                       points * sizeof(PPoint));
+            pc.header.stamp = s->stamp;
+            pc.header.frame_id.assign(s->frame_id,
+                                      strnlen(s->frame_id, sizeof(s->frame_id)));
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->lock, __ATOMIC_RELAXED) == lock)
+            {
+                pc.width = points;
+                pc.height = 1;
+                if (seq > last_sequence_ + 1)
+                    missed_ += seq - last_sequence_ - 1;
+                last_sequence_ = seq;
+                if (sequence)
+                    *sequence = seq;
+                return 0;
+            }
+        }
+        seq = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    }
+    return EAGAIN;
+}
+
+////////////////////////////////////////////////////////////////////////
+// ShmCloudSubscriber
+////////////////////////////////////////////////////////////////////////
+
+ShmCloudSubscriber::ShmCloudSubscriber(const std::string &name,
+                                       const Callback &callback):
+    name_(name), callback_(callback), running_(true), missed_(0)
+{
+    thread_ = boost::thread(boost::bind(&ShmCloudSubscriber::run, this));
+}
+
+ShmCloudSubscriber::~ShmCloudSubscriber()
+{
+    running_ = false;
+    thread_.join();
+}
+
+void ShmCloudSubscriber::run()
+{
+    static const double READ_TIMEOUT = 0.5;     // seconds
+    static const int REOPEN_TIMEOUTS = 6;
+
+    ShmRingReader reader;
+    int timeouts = 0;
+    uint64_t missed_before = 0;
+    while (running_)
+    {
+        if (!reader.isOpen())
+        {
+            if (reader.open(name_) != 0)
+            {
+                usleep(READ_TIMEOUT * 1e6);
+                continue;
+            }
+            missed_before = reader.missed();
+            timeouts = 0;
+        }
+
+        PPointCloud::Ptr pc(new PPointCloud());
+        int rc = reader.read(*pc, READ_TIMEOUT);
+        if (rc == 0)
+        {
+            timeouts = 0;
+            missed_ += reader.missed() - missed_before;
+            missed_before = reader.missed();
+            callback_(pc);
+        }
+        else if (rc == ETIMEDOUT && ++timeouts >= REOPEN_TIMEOUTS)
+        {
+            // the writer may have been restarted with a new segment
+            reader.close();
+        }
+    }
+}
+
+} // namespace pandar_pointcloud
@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  GPS time shared by every Pandar40 of a process.
+ */
+
+#include <math.h>
+#include <ros/ros.h>
+
+#include <pandar_pointcloud/time_base.h>
+
+namespace pandar_rawdata
+{
+/** weight of a new GPS time in the offset, which only follows the
+    receive latency: the whole seconds never change while locked */
+static const double OFFSET_GAIN = 0.1;
+
+TimeBase &TimeBase::instance()
+{
+    static boost::mutex lock;
+    // never destroyed: decoding threads may run until the process exits
+    static TimeBase *timeBase = NULL;
+
+    boost::mutex::scoped_lock guard(lock);
+    if (timeBase == NULL)
+        timeBase = new TimeBase();
+    return *timeBase;
+}
+
+TimeBase::TimeBase():
+    candidate_(0.0), candidates_(0)
+{
+    stats_.locked = false;
+    stats_.offset = 0.0;
+    stats_.accepted = 0;
+    stats_.outliers = 0;
+    stats_.relocks = 0;
+}
+
+bool TimeBase::addGps(time_t second, double pulse)
+{
+    double offset = second - pulse;
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stats_.locked && fabs(offset - stats_.offset) < 0.5)
+    {
+        stats_.offset += OFFSET_GAIN * (offset - stats_.offset);
+        stats_.accepted++;
+        candidates_ = 0;
+        return true;
+    }
+
+    // a first time, or one off by whole seconds: use it once enough
+    // GPS packets agree
+    if (candidates_ > 0 && fabs(offset - candidate_) < 0.5)
+        candidates_++;
+    else
+    {
+        candidate_ = offset;
+        candidates_ = 1;
+    }
+
+    if (!stats_.locked)
+    {
+        if (candidates_ < LOCK_SAMPLES)
+            return false;
+        ROS_INFO("time base locked to GPS, offset %.3f s", candidate_);
+        stats_.locked = true;
+    }
+    else
+    {
+        stats_.outliers++;
+        if (candidates_ < RELOCK_SAMPLES)
+        {
+            ROS_WARN_THROTTLE(10, "GPS time %.3f s away from the time base,"
+                              " ignored", offset - stats_.offset);
+            return false;
+        }
+        ROS_WARN("time base moved by %.3f s", candidate_ - stats_.offset);
+        stats_.relocks++;
+    }
+    stats_.offset = candidate_;
+    stats_.accepted++;
+    candidates_ = 0;
+    return true;
+}
+
+time_t TimeBase::second(uint32_t usec, double stamp)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!stats_.locked)
+        return -1;
+    return (time_t) floor(stamp - usec * 1e-6 + stats_.offset + 0.5);
+}
+
+time_base_stats_t TimeBase::stats()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return stats_;
+}
+
+} // namespace pandar_rawdata
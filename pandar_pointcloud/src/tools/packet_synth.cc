@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Synthetic Pandar40 packet generation for benchmarks and offline
+    tools.
+
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include <pandar_pointcloud/calibration.h>
+#include "packet_synth.h"
+
+namespace pandar_tools
+{
+  using namespace pandar_rawdata;
+
+  static const double SENSOR_HEIGHT = 1.8;      // meters above ground
+  static const double RANGE_UNIT = 0.002;       // meters per range count
+
+  /** elevation of each laser, from the default calibration */
+  static double sin_elevation[LASER_COUNT];
+  static double cos_elevation[LASER_COUNT];
+
+  /** store a two digit field as ASCII, ones digit first */
+  static void putDigits(uint8_t *buf, int value)
+  {
+    buf[0] = '0' + value % 10;
+    buf[1] = '0' + (value / 10) % 10;
+  }
+
+  void makeGpsPacket(uint8_t *buf, time_t utc)
+  {
+    struct tm t;
+    gmtime_r(&utc, &t);
+
+    memset(buf, 0, GPS_PACKET_SIZE);
+    buf[0] = 0xff;                                  // flag
+    buf[1] = 0xee;
+    // same field order as HS_L40_GPS_Parse() expects
+    putDigits(&buf[2], t.tm_year % 100);
+    putDigits(&buf[4], t.tm_mon + 1);
+    putDigits(&buf[6], t.tm_mday);
+    putDigits(&buf[8], t.tm_sec);
+    putDigits(&buf[10], t.tm_min);
+    putDigits(&buf[12], t.tm_hour);
+  }
+
+  PacketSynthesizer::PacketSynthesizer(double rpm, uint32_t seed,
+                                       int start_azimuth,
+                                       uint32_t start_usec):
+    rpm_(rpm),
+    azimuth_(start_azimuth % 36000),
+    usec_exact_(start_usec % 1000000),
+    usec_(start_usec % 1000000),
+    state_(seed ? seed : 1), dual_(false)
+  {
+    // blocks are fired at a fixed rate, so the azimuth step grows
+    // with the rotation speed
+    double blocks_per_second = PACKET_RATE * BLOCKS_PER_PACKET;
+    azimuth_step_ = (int) lrint(36000.0 * (rpm_ / 60.0) / blocks_per_second);
+    if (azimuth_step_ < 1)
+      azimuth_step_ = 1;
+
+    pandar_pointcloud::Calibration calibration("");
+    for (int i = 0; i < LASER_COUNT; ++i)
+      {
+        sin_elevation[i] = calibration.laser_corrections[i].sinVertCorrection;
+        cos_elevation[i] = calibration.laser_corrections[i].cosVertCorrection;
+      }
+  }
+
+  int PacketSynthesizer::packetsPerRevolution() const
+  {
+    int firings = dual_ ? BLOCKS_PER_PACKET / 2 : BLOCKS_PER_PACKET;
+    return (int) ceil(36000.0 / (azimuth_step_ * firings));
+  }
+
+  /** xorshift32, good enough for noise and dropouts */
+  uint32_t PacketSynthesizer::random()
+  {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+
+  uint32_t PacketSynthesizer::range(int laser, int azimuth)
+  {
+    // about 3% of the firings see nothing
+    if (random() % 100 < 3)
+      return 0;
+
+    double meters;
+    if (sin_elevation[laser] < -0.01)
+      {
+        // downward lasers hit the ground plane
+        meters = SENSOR_HEIGHT / -sin_elevation[laser];
+      }
+    else
+      {
+        // the others hit a ring of walls 10 to 30 meters away
+        double a = azimuth * M_PI / 18000.0;
+        meters = (20.0 + 10.0 * sin(3.0 * a)) / cos_elevation[laser];
+      }
+    if (meters > 130.0)
+      meters = 130.0;
+
+    int noise = (int) (random() % 5) - 2;
+    return (uint32_t) (meters / RANGE_UNIT) + noise;
+  }
+
+  void PacketSynthesizer::next(uint8_t *buf)
+  {
+    int index = 0;
+    for (int i = 0; i < BLOCKS_PER_PACKET; ++i)
+      {
+        buf[index] = 0xff;                          // start of block
+        buf[index + 1] = 0xee;
+        buf[index + 2] = azimuth_ & 0xff;
+        buf[index + 3] = (azimuth_ >> 8) & 0xff;
+        index += SOB_ANGLE_SIZE;
+
+        // the second block of a dual return pair is the last return
+        bool second = dual_ && (i % 2) == 1;
+        for (int j = 0; j < LASER_COUNT; ++j)
+          {
+            uint32_t r;
+            uint16_t reflectivity;
+            if (second)
+              {
+                r = first_range_[j];
+                reflectivity = first_reflectivity_[j];
+                // a fifth of the returns see through, to something
+                // farther and dimmer
+                if (r && random() % 5 == 0)
+                  {
+                    r += 500 + random() % 1500;
+                    reflectivity = (uint16_t) (((reflectivity >> 8) / 2) << 8);
+                  }
+              }
+            else
+              {
+                r = range(j, azimuth_);
+                reflectivity = r ? (uint16_t) ((20 + j * 3 +
+                                                random() % 16) << 8) : 0;
+                first_range_[j] = r;
+                first_reflectivity_[j] = reflectivity;
+              }
+            buf[index] = r & 0xff;
+            buf[index + 1] = (r >> 8) & 0xff;
+            buf[index + 2] = (r >> 16) & 0xff;
+            buf[index + 3] = reflectivity & 0xff;
+            buf[index + 4] = (reflectivity >> 8) & 0xff;
+            index += RAW_MEASURE_SIZE;
+          }
+
+        if (!dual_ || second)
+          azimuth_ = (azimuth_ + azimuth_step_) % 36000;
+      }
+
+    memset(&buf[index], 0, RESERVE_SIZE);
+    index += RESERVE_SIZE;
+
+    uint16_t revolution = (uint16_t) lrint(rpm_);
+    buf[index] = revolution & 0xff;
+    buf[index + 1] = (revolution >> 8) & 0xff;
+    index += REVOLUTION_SIZE;
+
+    // the device stamps a packet after its last block, and the
+    // counter restarts on every PPS
+    usec_exact_ += 1000000.0 / (dual_ ? 2 * PACKET_RATE : PACKET_RATE);
+    if (usec_exact_ >= 1000000.0)
+      usec_exact_ -= 1000000.0;
+    usec_ = (uint32_t) usec_exact_;
+    buf[index] = usec_ & 0xff;
+    buf[index + 1] = (usec_ >> 8) & 0xff;
+    buf[index + 2] = (usec_ >> 16) & 0xff;
+    buf[index + 3] = (usec_ >> 24) & 0xff;
+    index += TIMESTAMP_SIZE;
+
+    buf[index] = dual_ ? RETURN_MODE_DUAL : 0x42;   // factory id
+    buf[index + 1] = 0x0a;
+  }
+
+} // namespace pandar_tools
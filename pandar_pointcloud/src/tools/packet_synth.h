@@ -0,0 +1,97 @@
+/* -*- mode: C++ -*- */
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Synthetic Pandar40 packet generation for benchmarks and offline
+    tools.  Packets are laid out byte-for-byte as the device sends
+    them, so they can be fed to RawData::parseRawData() or written to
+    a socket or a PCAP file.
+
+*/
+
+#ifndef _PANDAR_TOOLS_PACKET_SYNTH_H_
+#define _PANDAR_TOOLS_PACKET_SYNTH_H_ 1
+
+#include <stdint.h>
+#include <time.h>
+
+#include <pandar_pointcloud/rawdata.h>
+
+namespace pandar_tools
+{
+  /** Packet frequency of a Pandar40 (Hz), independent of the RPM,
+   *  twice as high in dual return mode. */
+  static const double PACKET_RATE = 3000.0;
+
+  /** Size of the GPS packet sent once per second. */
+  static const int GPS_PACKET_SIZE = 512;
+
+  /** @brief Fill @c buf with a GPS packet reporting @c utc.
+   *
+   *  The device sends it shortly after each PPS, reporting the second
+   *  that just ended; the drivers add one second when they apply it.
+   *
+   *  @param buf at least GPS_PACKET_SIZE bytes
+   */
+  void makeGpsPacket(uint8_t *buf, time_t utc);
+
+  /** @brief Generates a deterministic stream of Pandar40 data packets.
+   *
+   *  The azimuth advances by the step implied by @c rpm, the
+   *  microsecond timestamp advances at PACKET_RATE and wraps every
+   *  second like the device counter does, and the ranges describe a
+   *  flat ground plane and a ring of walls with a small fraction of
+   *  missing returns.
+   *
+   *  In dual return mode each firing takes a pair of blocks, the
+   *  strongest and the last return, and packets come twice as often.
+   *  Most second returns repeat the first; a few see through to
+   *  something farther and dimmer.
+   */
+  class PacketSynthesizer
+  {
+  public:
+
+    PacketSynthesizer(double rpm = 600.0, uint32_t seed = 1,
+                      int start_azimuth = 0, uint32_t start_usec = 0);
+
+    /** @brief Fill @c buf with the next data packet.
+     *
+     *  @param buf at least pandar_rawdata::PACKET_SIZE bytes
+     */
+    void next(uint8_t *buf);
+
+    /** @brief Microsecond timestamp of the packet returned by next(). */
+    uint32_t timestamp() const { return usec_; }
+
+    /** @brief Number of packets per revolution at the configured RPM. */
+    int packetsPerRevolution() const;
+
+    /** @brief Generate dual return packets from the next one on. */
+    void setDualReturn(bool dual) { dual_ = dual; }
+
+  private:
+
+    uint32_t range(int laser, int azimuth);
+    uint32_t random();
+
+    double rpm_;
+    int azimuth_step_;           ///< 0.01 degree units per block
+    int azimuth_;                ///< azimuth of the next block
+    double usec_exact_;          ///< timestamp without rounding
+    uint32_t usec_;
+    uint32_t state_;
+    bool dual_;
+    uint32_t first_range_[pandar_rawdata::LASER_COUNT];  ///< of the pair
+    uint16_t first_reflectivity_[pandar_rawdata::LASER_COUNT];
+  };
+
+} // namespace pandar_tools
+
+#endif // _PANDAR_TOOLS_PACKET_SYNTH_H_
@@ -0,0 +1,325 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Micro benchmarks for the pandar_rawdata decode path.
+
+    Each stage is run over synthetic packets, and again over the
+    packets of a recorded capture when one is given:
+
+      rawdata_bench [--pcap=<file>] [--calibration=<file>]
+                    [benchmark options]
+
+    Besides the usual timings, every benchmark reports the time per packet and
+    points/s; the frame assembly benchmark also reports heap
+    allocations per frame.
+
+*/
+
+#include <new>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap.h>
+
+#include <benchmark/benchmark.h>
+#include <boost/atomic.hpp>
+
+#include <pandar_pointcloud/rawdata.h>
+#include "packet_synth.h"
+
+/** count every heap allocation made by this process */
+static boost::atomic<unsigned long> allocation_count(0);
+
+void *operator new(size_t size)
+{
+  allocation_count.fetch_add(1, boost::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+  free(p);
+}
+
+namespace pandar_rawdata
+{
+  /** befriended by RawData, forwards to its private decode stages */
+  class RawDataBenchmark
+  {
+  public:
+    static int parseRawData(RawData &data, raw_packet_t *packet,
+                            const uint8_t *buf, int len)
+    {
+      return data.parseRawData(packet, buf, len);
+    }
+    static void computeXYZIR(RawData &data, PPoint &point, int azimuth,
+                             const raw_measure_t &measure, int laser)
+    {
+      data.computeXYZIR(point, azimuth, measure,
+                        data.calibration_.laser_corrections[laser]);
+    }
+    static void toPointClouds(RawData &data, raw_packet_t *packet,
+                              int block, PPointCloud &pc, double stamp)
+    {
+      double first_stamp = 0.0;
+      data.toPointClouds(packet, block, pc, stamp, first_stamp);
+    }
+  };
+} // namespace pandar_rawdata
+
+namespace
+{
+  using namespace pandar_rawdata;
+  typedef pandar_rawdata::RawDataBenchmark Access;
+
+  /** packets in one revolution at 600 RPM */
+  const size_t REVOLUTION_PACKETS = 300;
+
+  std::string pcap_file;
+  std::string calibration_file;
+
+  /** packets used by the benchmarks, loaded once */
+  std::vector<pandar_msgs::PandarPacket> synthetic_packets;
+  std::vector<pandar_msgs::PandarPacket> recorded_packets;
+
+  void makeSynthetic(int count)
+  {
+    pandar_tools::PacketSynthesizer synth(600.0);
+    synthetic_packets.resize(count);
+    for (int i = 0; i < count; ++i)
+      synth.next(&synthetic_packets[i].data[0]);
+  }
+
+  /** read the Pandar40 data packets of a capture, skipping GPS */
+  void loadRecorded(const std::string &file)
+  {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(file.c_str(), errbuf);
+    if (pcap == NULL)
+      {
+        fprintf(stderr, "unable to open %s: %s\n", file.c_str(), errbuf);
+        return;
+      }
+
+    struct pcap_pkthdr *header;
+    const u_char *pkt_data;
+    while (pcap_next_ex(pcap, &header, &pkt_data) >= 0)
+      {
+        // 42 bytes of ethernet, IP and UDP headers
+        if (header->caplen != PACKET_SIZE + 42)
+          continue;
+        pandar_msgs::PandarPacket packet;
+        memcpy(&packet.data[0], pkt_data + 42, PACKET_SIZE);
+        recorded_packets.push_back(packet);
+      }
+    pcap_close(pcap);
+  }
+
+  const std::vector<pandar_msgs::PandarPacket> &packets(int source)
+  {
+    return source == 0 ? synthetic_packets : recorded_packets;
+  }
+
+  bool setUp(benchmark::State &state, RawData &data)
+  {
+    if (packets(state.range(0)).empty())
+      {
+        state.SkipWithError("no recorded packets, use --pcap=<file>");
+        return false;
+      }
+    data.setupOffline(calibration_file, 130.0, 0.5);
+    return true;
+  }
+
+  void setCounters(benchmark::State &state, double packet_count,
+                   double point_count)
+  {
+    // inverted rate, printed with an SI prefix, e.g. 540ns
+    state.counters["time/packet"] =
+      benchmark::Counter(packet_count,
+                         benchmark::Counter::kIsRate |
+                         benchmark::Counter::kInvert);
+    state.counters["points/s"] =
+      benchmark::Counter(point_count, benchmark::Counter::kIsRate);
+    state.SetItemsProcessed((int64_t) packet_count);
+  }
+
+  /** byte parsing of a whole packet */
+  void BM_ParseRawData(benchmark::State &state)
+  {
+    RawData data;
+    if (!setUp(state, data))
+      return;
+    const std::vector<pandar_msgs::PandarPacket> &input =
+      packets(state.range(0));
+    raw_packet_t packet;
+    size_t next = 0;
+    double packet_count = 0;
+    for (auto _ : state)
+      {
+        Access::parseRawData(data, &packet, &input[next].data[0],
+                             PACKET_SIZE);
+        benchmark::DoNotOptimize(packet);
+        next = (next + 1) % input.size();
+        ++packet_count;
+      }
+    setCounters(state, packet_count, 0);
+  }
+
+  /** point conversion of every measure of a packet */
+  void BM_ComputeXYZIR(benchmark::State &state)
+  {
+    RawData data;
+    if (!setUp(state, data))
+      return;
+    const std::vector<pandar_msgs::PandarPacket> &input =
+      packets(state.range(0));
+    std::vector<raw_packet_t> parsed(input.size());
+    for (size_t i = 0; i < input.size(); ++i)
+      Access::parseRawData(data, &parsed[i], &input[i].data[0], PACKET_SIZE);
+
+    size_t next = 0;
+    double packet_count = 0;
+    double point_count = 0;
+    PPoint point;
+    for (auto _ : state)
+      {
+        const raw_packet_t &packet = parsed[next];
+        for (int i = 0; i < BLOCKS_PER_PACKET; ++i)
+          for (int j = 0; j < LASER_COUNT; ++j)
+            {
+              Access::computeXYZIR(data, point, packet.blocks[i].azimuth,
+                                   packet.blocks[i].measures[j], j);
+              benchmark::DoNotOptimize(point);
+            }
+        next = (next + 1) % parsed.size();
+        ++packet_count;
+        point_count += BLOCKS_PER_PACKET * LASER_COUNT;
+      }
+    setCounters(state, packet_count, point_count);
+  }
+
+  /** conversion of parsed packets into a cloud, one block at a time */
+  void BM_ToPointClouds(benchmark::State &state)
+  {
+    RawData data;
+    if (!setUp(state, data))
+      return;
+    const std::vector<pandar_msgs::PandarPacket> &input =
+      packets(state.range(0));
+    std::vector<raw_packet_t> parsed(input.size());
+    for (size_t i = 0; i < input.size(); ++i)
+      Access::parseRawData(data, &parsed[i], &input[i].data[0], PACKET_SIZE);
+
+    PPointCloud pc;
+    size_t next = 0;
+    double packet_count = 0;
+    double point_count = 0;
+    for (auto _ : state)
+      {
+        // start over once per revolution, like the converter does
+        if (next % REVOLUTION_PACKETS == 0)
+          {
+            point_count += pc.points.size();
+            pc.clear();
+          }
+        for (int i = 0; i < BLOCKS_PER_PACKET; ++i)
+          Access::toPointClouds(data, &parsed[next], i, pc, 0.0);
+        next = (next + 1) % parsed.size();
+        ++packet_count;
+      }
+    point_count += pc.points.size();
+    setCounters(state, packet_count, point_count);
+  }
+
+  /** parsing, frame splitting and conversion as done by unpack() */
+  void BM_Unpack(benchmark::State &state)
+  {
+    RawData data;
+    if (!setUp(state, data))
+      return;
+    std::vector<pandar_msgs::PandarPacket> input = packets(state.range(0));
+
+    PPointCloud pc;
+    time_t gps1 = 0;
+    gps_struct_t gps2;
+    gps2.used = 1;
+    gps2.gps = 0;
+    int start_angle = 0;
+    size_t next = 0;
+    double packet_count = 0;
+    double point_count = 0;
+    double frame_count = 0;
+    unsigned long allocations = 0;
+    for (auto _ : state)
+      {
+        double first_stamp = 0.0;
+        unsigned long before =
+          allocation_count.load(boost::memory_order_relaxed);
+        int frame = data.unpack(input[next], pc, gps1, gps2, first_stamp,
+                                start_angle);
+        allocations +=
+          allocation_count.load(boost::memory_order_relaxed) - before;
+        if (frame == 1)
+          {
+            ++frame_count;
+            point_count += pc.points.size();
+            pc.clear();
+          }
+        next = (next + 1) % input.size();
+        ++packet_count;
+      }
+    setCounters(state, packet_count, point_count);
+    state.counters["frames"] = frame_count;
+    state.counters["allocs/frame"] =
+      frame_count ? allocations / frame_count : 0.0;
+  }
+
+} // namespace
+
+// arg 0 selects the packets: 0 synthetic, 1 recorded
+BENCHMARK(BM_ParseRawData)->Arg(0)->Arg(1);
+BENCHMARK(BM_ComputeXYZIR)->Arg(0)->Arg(1);
+BENCHMARK(BM_ToPointClouds)->Arg(0)->Arg(1);
+BENCHMARK(BM_Unpack)->Arg(0)->Arg(1);
+
+int main(int argc, char **argv)
+{
+  benchmark::Initialize(&argc, argv);
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 7, "--pcap=") == 0)
+        pcap_file = arg.substr(7);
+      else if (arg.compare(0, 14, "--calibration=") == 0)
+        calibration_file = arg.substr(14);
+      else
+        {
+          fprintf(stderr, "unknown option %s\n", argv[i]);
+          return 1;
+        }
+    }
+
+  // one second of data, so the timestamps wrap like the device's
+  makeSynthetic((int) pandar_tools::PACKET_RATE);
+  if (!pcap_file.empty())
+    loadRecorded(pcap_file);
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
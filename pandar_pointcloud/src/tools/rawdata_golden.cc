@@ -0,0 +1,318 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Golden output regression check for the pandar_rawdata decoder.
+
+    Runs RawData offline over a capture, the same way the cloud
+    nodelet does, and summarizes every frame: the packet that closed
+    it, its point count and first stamp, a hash of all point fields
+    and the mean of each coordinate.  The summaries are compared with
+    a golden file recorded before a decoder change:
+
+      rawdata_golden --pcap=<file> --golden=<file> [--record]
+                     [--epsilon=<e>] [--calibration=<file>]
+                     [--start-angle=<deg>]
+
+    With the default epsilon of 0 every frame must hash identically,
+    so the output is bit-for-bit unchanged.  With a positive epsilon
+    the frame boundaries and point counts must still match, while the
+    stamps and means may differ by up to epsilon; hash differences are
+    then only reported.  The exit status is 0 when the output matches.
+
+*/
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pcap.h>
+
+#include <pandar_pointcloud/rawdata.h>
+
+namespace
+{
+  using namespace pandar_rawdata;
+
+  /** ethernet, IPv4 and UDP headers in front of each captured packet */
+  static const int FRAME_HEADER_SIZE = 42;
+
+  /** summary of one decoded frame */
+  struct FrameSummary
+  {
+    long packet;                  ///< capture packet that closed the frame
+    unsigned long points;
+    double stamp;                 ///< first point stamp
+    uint64_t hash;
+    double mean[4];               ///< x, y, z, intensity
+  };
+
+  /** 64 bit FNV-1a */
+  class Hash
+  {
+  public:
+    Hash(): value_(14695981039346656037ULL) {}
+    void add(const void *data, size_t len)
+    {
+      const uint8_t *p = (const uint8_t *) data;
+      for (size_t i = 0; i < len; ++i)
+        {
+          value_ ^= p[i];
+          value_ *= 1099511628211ULL;
+        }
+    }
+    uint64_t value() const { return value_; }
+  private:
+    uint64_t value_;
+  };
+
+  FrameSummary summarize(const PPointCloud &pc, long packet, double stamp)
+  {
+    FrameSummary f;
+    f.packet = packet;
+    f.points = pc.points.size();
+    f.stamp = stamp;
+
+    // hash the fields one by one, so padding never matters
+    Hash hash;
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < pc.points.size(); ++i)
+      {
+        const PPoint &p = pc.points[i];
+        hash.add(&p.x, sizeof(p.x));
+        hash.add(&p.y, sizeof(p.y));
+        hash.add(&p.z, sizeof(p.z));
+        hash.add(&p.intensity, sizeof(p.intensity));
+        hash.add(&p.timestamp, sizeof(p.timestamp));
+        hash.add(&p.ring, sizeof(p.ring));
+        hash.add(&p.return_index, sizeof(p.return_index));
+        sum[0] += p.x;
+        sum[1] += p.y;
+        sum[2] += p.z;
+        sum[3] += p.intensity;
+      }
+    hash.add(&f.points, sizeof(f.points));
+    hash.add(&f.stamp, sizeof(f.stamp));
+    f.hash = hash.value();
+    for (int i = 0; i < 4; ++i)
+      f.mean[i] = f.points ? sum[i] / f.points : 0.0;
+    return f;
+  }
+
+  /** decode a capture like Convert does, one packet at a time */
+  bool decode(const std::string &pcap_file, const std::string &calibration,
+              int start_angle, std::vector<FrameSummary> &frames)
+  {
+    RawData data;
+    if (data.setupOffline(calibration, 130.0, 0.5) != 0)
+      return false;
+    // dual return captures are decoded like the nodelet does by default
+    data.setDualReturnPolicy(DUAL_DEDUPE);
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(pcap_file.c_str(), errbuf);
+    if (pcap == NULL)
+      {
+        fprintf(stderr, "unable to open %s: %s\n", pcap_file.c_str(), errbuf);
+        return false;
+      }
+
+    time_t gps1 = 0;
+    gps_struct_t gps2;
+    gps2.gps = 0;
+    gps2.used = 1;
+    PPointCloud pc;
+    pandar_msgs::PandarPacket packet;
+    struct pcap_pkthdr *header;
+    const u_char *pkt_data;
+    long index = 0;
+    while (pcap_next_ex(pcap, &header, &pkt_data) >= 0)
+      {
+        ++index;
+        if (header->caplen == GPS_PACKET_SIZE + FRAME_HEADER_SIZE)
+          {
+            pandar_msgs::PandarGps gps;
+            if (parseGpsPacket(gps, pkt_data + FRAME_HEADER_SIZE,
+                               GPS_PACKET_SIZE) == 0)
+              updateGps(gps, gps2);
+            continue;
+          }
+        if (header->caplen != PACKET_SIZE + FRAME_HEADER_SIZE)
+          continue;
+
+        memcpy(&packet.data[0], pkt_data + FRAME_HEADER_SIZE, PACKET_SIZE);
+        packet.stamp = ros::Time(header->ts.tv_sec + header->ts.tv_usec * 1e-6);
+        double stamp = 0.0;
+        if (data.unpack(packet, pc, gps1, gps2, stamp, start_angle) == 1)
+          {
+            frames.push_back(summarize(pc, index, stamp));
+            pc.clear();
+          }
+      }
+    pcap_close(pcap);
+    return true;
+  }
+
+  std::string format(const FrameSummary &f)
+  {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%ld %lu %.6f %016llx %.9g %.9g %.9g %.9g",
+             f.packet, f.points, f.stamp, (unsigned long long) f.hash,
+             f.mean[0], f.mean[1], f.mean[2], f.mean[3]);
+    return line;
+  }
+
+  bool parse(const std::string &line, FrameSummary &f)
+  {
+    unsigned long long hash;
+    if (sscanf(line.c_str(), "%ld %lu %lf %llx %lf %lf %lf %lf",
+               &f.packet, &f.points, &f.stamp, &hash,
+               &f.mean[0], &f.mean[1], &f.mean[2], &f.mean[3]) != 8)
+      return false;
+    f.hash = hash;
+    return true;
+  }
+
+  bool record(const std::string &file, const std::string &pcap_file,
+              const std::vector<FrameSummary> &frames)
+  {
+    std::ofstream out(file.c_str());
+    if (!out)
+      {
+        fprintf(stderr, "unable to write %s\n", file.c_str());
+        return false;
+      }
+    out << "# rawdata_golden " << pcap_file << "\n"
+        << "# packet points stamp hash mean_x mean_y mean_z mean_intensity\n";
+    for (size_t i = 0; i < frames.size(); ++i)
+      out << format(frames[i]) << "\n";
+    printf("recorded %zu frames in %s\n", frames.size(), file.c_str());
+    return true;
+  }
+
+  bool compare(const std::string &file, double epsilon,
+               const std::vector<FrameSummary> &frames)
+  {
+    std::ifstream in(file.c_str());
+    if (!in)
+      {
+        fprintf(stderr, "unable to read %s\n", file.c_str());
+        return false;
+      }
+
+    std::vector<FrameSummary> golden;
+    std::string line;
+    while (std::getline(in, line))
+      {
+        if (line.empty() || line[0] == '#')
+          continue;
+        FrameSummary f;
+        if (!parse(line, f))
+          {
+            fprintf(stderr, "bad golden line: %s\n", line.c_str());
+            return false;
+          }
+        golden.push_back(f);
+      }
+
+    bool ok = true;
+    if (golden.size() != frames.size())
+      {
+        printf("frame count: expected %zu, got %zu\n",
+               golden.size(), frames.size());
+        ok = false;
+      }
+    for (size_t i = 0; i < golden.size() && i < frames.size(); ++i)
+      {
+        const FrameSummary &g = golden[i];
+        const FrameSummary &f = frames[i];
+        bool same = g.packet == f.packet && g.points == f.points;
+        if (epsilon > 0.0)
+          {
+            same = same && fabs(g.stamp - f.stamp) <= epsilon;
+            for (int j = 0; j < 4; ++j)
+              same = same && fabs(g.mean[j] - f.mean[j]) <= epsilon;
+            if (same && g.hash != f.hash)
+              printf("frame %zu: within %g, but not bit-for-bit\n",
+                     i, epsilon);
+          }
+        else
+          {
+            same = same && g.hash == f.hash;
+          }
+        if (!same)
+          {
+            printf("frame %zu differs:\n  expected %s\n  got      %s\n",
+                   i, format(g).c_str(), format(f).c_str());
+            ok = false;
+          }
+      }
+
+    printf("%s: %zu frames compared with %s\n", ok ? "PASS" : "FAIL",
+           frames.size(), file.c_str());
+    return ok;
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  std::string pcap_file;
+  std::string golden_file;
+  std::string calibration;
+  double epsilon = 0.0;
+  double start_angle = 0.0;
+  bool do_record = false;
+
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 7, "--pcap=") == 0)
+        pcap_file = arg.substr(7);
+      else if (arg.compare(0, 9, "--golden=") == 0)
+        golden_file = arg.substr(9);
+      else if (arg.compare(0, 14, "--calibration=") == 0)
+        calibration = arg.substr(14);
+      else if (arg.compare(0, 10, "--epsilon=") == 0)
+        epsilon = atof(arg.substr(10).c_str());
+      else if (arg.compare(0, 14, "--start-angle=") == 0)
+        start_angle = atof(arg.substr(14).c_str());
+      else if (arg == "--record")
+        do_record = true;
+      else
+        {
+          fprintf(stderr, "unknown option %s\n", argv[i]);
+          return 2;
+        }
+    }
+  if (pcap_file.empty() || golden_file.empty())
+    {
+      fprintf(stderr, "usage: %s --pcap=<file> --golden=<file> [--record]\n"
+              "          [--epsilon=<e>] [--calibration=<file>]"
+              " [--start-angle=<deg>]\n", argv[0]);
+      return 2;
+    }
+
+  // GPS seconds go through mktime(), keep them independent of the host
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  std::vector<FrameSummary> frames;
+  if (!decode(pcap_file, calibration, int(start_angle * 100), frames))
+    return 2;
+
+  if (do_record)
+    return record(golden_file, pcap_file, frames) ? 0 : 2;
+  return compare(golden_file, epsilon, frames) ? 0 : 1;
+}
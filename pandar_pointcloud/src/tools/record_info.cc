@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Summarizes a cloud recording of the record nodelet, and measures
+    how fast its points can be read:
+
+      record_info --file=<file> [--frame=<n>]
+
+    Prints the frame count, the stamps covered and the points stored,
+    then reads every frame in order and reports the read rate.  With
+    --frame, the stamp and point count of that frame are printed too.
+
+*/
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pandar_pointcloud/cloud_record.h>
+
+namespace
+{
+  double monotonic()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+} // namespace
+
+int main(int argc, char **argv)
+{
+  std::string file;
+  long frame = -1;
+
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 7, "--file=") == 0)
+        file = arg.substr(7);
+      else if (arg.compare(0, 8, "--frame=") == 0)
+        frame = atol(arg.substr(8).c_str());
+      else
+        {
+          fprintf(stderr, "unknown option %s\n", argv[i]);
+          return 2;
+        }
+    }
+  if (file.empty())
+    {
+      fprintf(stderr, "usage: %s --file=<file> [--frame=<n>]\n", argv[0]);
+      return 2;
+    }
+
+  pandar_pointcloud::CloudRecordReader reader;
+  int rc = reader.open(file);
+  if (rc != 0)
+    {
+      fprintf(stderr, "unable to open %s: %s\n", file.c_str(), strerror(rc));
+      return 2;
+    }
+
+  size_t frames = reader.frames();
+  printf("%s: %zu frames, frame_id %s\n", file.c_str(), frames,
+         reader.frameId().c_str());
+  if (frames == 0)
+    return 0;
+  printf("stamps %.6f - %.6f\n", reader.frame(0).stamp * 1e-6,
+         reader.frame(frames - 1).stamp * 1e-6);
+
+  if (frame >= 0)
+    {
+      if ((size_t) frame >= frames)
+        {
+          fprintf(stderr, "frame %ld out of range\n", frame);
+          return 2;
+        }
+      printf("frame %ld: stamp %.6f, %u points\n", frame,
+             reader.frame(frame).stamp * 1e-6, reader.frame(frame).points);
+    }
+
+  // touch every point, so the pages are really read
+  double start = monotonic();
+  uint64_t points = 0;
+  double sum = 0.0;
+  for (size_t i = 0; i < frames; ++i)
+    {
+      uint32_t count;
+      const pandar_rawdata::PPoint *p = reader.points(i, count);
+      if (p == NULL)
+        {
+          fprintf(stderr, "frame %zu can not be read\n", i);
+          return 1;
+        }
+      for (uint32_t j = 0; j < count; ++j)
+        sum += p[j].x;
+      points += count;
+    }
+  double elapsed = monotonic() - start;
+  double bytes = points * sizeof(pandar_rawdata::PPoint);
+  printf("%llu points, %.1f MB read in %.3f s: %.0f MB/s (checksum %g)\n",
+         (unsigned long long) points, bytes * 1e-6, elapsed,
+         elapsed > 0.0 ? bytes * 1e-6 / elapsed : 0.0, sum);
+  return 0;
+}
@@ -0,0 +1,491 @@
+/*
+ *  Copyright (c) 2017 Hesai Photonics Technology, Yang Sheng
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+
+    Synthetic Pandar40 UDP traffic generator, for load and soak
+    testing of the drivers without hardware.
+
+    Every simulated sensor sends 1240 byte data packets and one 512
+    byte GPS packet per second to its own UDP port (port, port + 1,
+    ...), like a Pandar40 configured for that port would.  Packet
+    loss, reordering and bursts can be injected:
+
+      pandar_traffic_gen [options]
+
+        --host <ip>          destination address (127.0.0.1)
+        --port <n>           UDP port of the first sensor (8080)
+        --sensors <n>        number of sensors (1)
+        --rpm <rpm>          rotation speed of the packet contents (600)
+        --rate <hz>          packets per second per sensor (3000, or
+                             6000 with --dual)
+        --duration <s>       stop after this many seconds (run forever)
+        --loss <percent>     drop this share of the data packets
+        --reorder <percent>  delay this share of the data packets ...
+        --reorder-depth <n>  ... by n packets (1)
+        --burst <n>          send packets in bursts of n, keeping the
+                             average rate
+        --no-gps             do not send GPS packets
+        --dual               send dual return packets
+        --seed <n>           seed of the loss and reorder decisions
+        --pcap <file>        write a capture file instead of sending,
+                             as fast as possible, see --duration
+        --start-time <t>     UTC time of the first packet, for
+                             reproducible capture files (now)
+
+    --rate only changes how fast packets are sent; their contents
+    still advance as if sent at the device rate of 3000 Hz (6000 Hz in
+    dual return mode), so a rate above that overloads the receivers.
+
+*/
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <pcap.h>
+
+#include "packet_synth.h"
+
+namespace
+{
+  using pandar_rawdata::PACKET_SIZE;
+  using pandar_tools::GPS_PACKET_SIZE;
+
+  /** ethernet, IPv4 and UDP headers in front of each captured packet */
+  static const int FRAME_HEADER_SIZE = 42;
+
+  struct Options
+  {
+    std::string host;
+    int port;
+    int sensors;
+    double rpm;
+    double rate;
+    double duration;
+    double loss;
+    double reorder;
+    int reorder_depth;
+    int burst;
+    bool gps;
+    bool dual;
+    uint32_t seed;
+    std::string pcap;
+    double start_time;
+
+    Options():
+      host("127.0.0.1"), port(8080), sensors(1), rpm(600.0), rate(0.0),
+      duration(0.0), loss(0.0), reorder(0.0), reorder_depth(1), burst(1),
+      gps(true), dual(false), seed(1), start_time(0.0)
+    {}
+  };
+
+  /** a data packet held back to be sent out of order */
+  struct Delayed
+  {
+    uint64_t release;                   ///< sequence number to send after
+    std::vector<uint8_t> data;
+  };
+
+  /** state of one simulated sensor */
+  struct Sensor
+  {
+    Sensor(const Options &opts, int index, time_t second, uint32_t usec):
+      synth(opts.rpm, opts.seed + index, (index * 4500) % 36000, usec),
+      port(opts.port + index),
+      second(second), sequence(0),
+      sent(0), dropped(0), reordered(0), gps_sent(0)
+    {
+      synth.setDualReturn(opts.dual);
+    }
+
+    pandar_tools::PacketSynthesizer synth;
+    int port;
+    time_t second;                      ///< UTC second of the PPS counter
+    uint64_t sequence;                  ///< data packets generated
+    std::deque<Delayed> delayed;
+
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t reordered;
+    uint64_t gps_sent;
+  };
+
+  /** where the packets go: a UDP socket or a capture file */
+  class Output
+  {
+  public:
+
+    Output(): sockfd_(-1), pcap_(NULL), dumper_(NULL) {}
+
+    ~Output()
+    {
+      if (sockfd_ >= 0)
+        close(sockfd_);
+      if (dumper_)
+        pcap_dump_close(dumper_);
+      if (pcap_)
+        pcap_close(pcap_);
+    }
+
+    bool openSocket(const std::string &host)
+    {
+      memset(&addr_, 0, sizeof(addr_));
+      addr_.sin_family = AF_INET;
+      if (inet_aton(host.c_str(), &addr_.sin_addr) == 0)
+        {
+          fprintf(stderr, "invalid address %s\n", host.c_str());
+          return false;
+        }
+      sockfd_ = socket(PF_INET, SOCK_DGRAM, 0);
+      if (sockfd_ == -1)
+        {
+          perror("socket");
+          return false;
+        }
+      return true;
+    }
+
+    bool openPcap(const std::string &file)
+    {
+      pcap_ = pcap_open_dead(DLT_EN10MB, 65535);
+      dumper_ = pcap_dump_open(pcap_, file.c_str());
+      if (dumper_ == NULL)
+        {
+          fprintf(stderr, "unable to write %s\n", file.c_str());
+          return false;
+        }
+      return true;
+    }
+
+    /** send one packet, @c stamp is only used for capture files */
+    void send(int port, const uint8_t *data, int len, double stamp)
+    {
+      if (dumper_)
+        {
+          dump(port, data, len, stamp);
+          return;
+        }
+      addr_.sin_port = htons(port);
+      if (sendto(sockfd_, data, len, 0, (sockaddr *) &addr_,
+                 sizeof(addr_)) != len)
+        {
+          // the receive side being down or slow is part of the test
+          if (errno != ECONNREFUSED && errno != ENOBUFS)
+            perror("sendto");
+        }
+    }
+
+  private:
+
+    void dump(int port, const uint8_t *data, int len, double stamp)
+    {
+      uint8_t frame[FRAME_HEADER_SIZE + PACKET_SIZE];
+      memset(frame, 0, FRAME_HEADER_SIZE);
+
+      // ethernet: broadcast from a made up device address, IPv4
+      memset(&frame[0], 0xff, 6);
+      frame[6] = 0x00; frame[7] = 0x0a; frame[8] = 0x35;
+      frame[12] = 0x08;
+
+      // IPv4 from 192.168.1.201 to 255.255.255.255
+      uint8_t *ip = &frame[14];
+      int ip_len = 20 + 8 + len;
+      ip[0] = 0x45;
+      ip[2] = ip_len >> 8; ip[3] = ip_len & 0xff;
+      ip[8] = 64;                               // ttl
+      ip[9] = 17;                               // udp
+      ip[12] = 192; ip[13] = 168; ip[14] = 1; ip[15] = 201;
+      ip[16] = 255; ip[17] = 255; ip[18] = 255; ip[19] = 255;
+      uint32_t sum = 0;
+      for (int i = 0; i < 20; i += 2)
+        sum += (ip[i] << 8) | ip[i + 1];
+      while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+      ip[10] = ~sum >> 8; ip[11] = ~sum & 0xff;
+
+      // UDP, checksum left out
+      uint8_t *udp = &frame[34];
+      int udp_len = 8 + len;
+      udp[0] = 0x27; udp[1] = 0x10;             // source port 10000
+      udp[2] = port >> 8; udp[3] = port & 0xff;
+      udp[4] = udp_len >> 8; udp[5] = udp_len & 0xff;
+
+      memcpy(&frame[FRAME_HEADER_SIZE], data, len);
+
+      struct pcap_pkthdr header;
+      header.ts.tv_sec = (time_t) stamp;
+      header.ts.tv_usec = (suseconds_t) ((stamp - floor(stamp)) * 1e6);
+      header.caplen = header.len = FRAME_HEADER_SIZE + len;
+      pcap_dump((u_char *) dumper_, &header, frame);
+    }
+
+    int sockfd_;
+    sockaddr_in addr_;
+    pcap_t *pcap_;
+    pcap_dumper_t *dumper_;
+  };
+
+  /** xorshift32 for the loss and reorder decisions */
+  uint32_t random(uint32_t &state)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  bool chance(uint32_t &state, double percent)
+  {
+    return percent > 0.0 && (random(state) % 1000000) < percent * 10000.0;
+  }
+
+  double monotonicNow()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  /** generate the next data packet of a sensor, and a GPS packet
+   *  when its PPS counter restarted */
+  void emit(const Options &opts, Output &out, Sensor &sensor,
+            uint32_t &rng, double stamp)
+  {
+    uint8_t buf[PACKET_SIZE];
+    uint32_t last_usec = sensor.synth.timestamp();
+    sensor.synth.next(buf);
+    uint64_t sequence = sensor.sequence++;
+
+    if (sensor.synth.timestamp() < last_usec)
+      {
+        ++sensor.second;
+        if (opts.gps)
+          {
+            uint8_t gps[GPS_PACKET_SIZE];
+            pandar_tools::makeGpsPacket(gps, sensor.second - 1);
+            out.send(sensor.port, gps, GPS_PACKET_SIZE, stamp);
+            ++sensor.gps_sent;
+          }
+      }
+
+    if (chance(rng, opts.loss))
+      {
+        ++sensor.dropped;
+      }
+    else if (chance(rng, opts.reorder))
+      {
+        Delayed d;
+        d.release = sequence + opts.reorder_depth;
+        d.data.assign(buf, buf + PACKET_SIZE);
+        sensor.delayed.push_back(d);
+        ++sensor.reordered;
+      }
+    else
+      {
+        out.send(sensor.port, buf, PACKET_SIZE, stamp);
+        ++sensor.sent;
+      }
+
+    while (!sensor.delayed.empty()
+           && sensor.delayed.front().release <= sequence)
+      {
+        out.send(sensor.port, &sensor.delayed.front().data[0],
+                 PACKET_SIZE, stamp);
+        sensor.delayed.pop_front();
+        ++sensor.sent;
+      }
+  }
+
+  /** send the packets still held back for reordering: a bounded run
+   *  ends with all it generated sent or dropped */
+  void flush(Output &out, Sensor &sensor, double stamp)
+  {
+    while (!sensor.delayed.empty())
+      {
+        out.send(sensor.port, &sensor.delayed.front().data[0],
+                 PACKET_SIZE, stamp);
+        sensor.delayed.pop_front();
+        ++sensor.sent;
+      }
+  }
+
+  void usage(const char *name)
+  {
+    fprintf(stderr,
+            "usage: %s [--host ip] [--port n] [--sensors n] [--rpm rpm]\n"
+            "          [--rate hz] [--duration s] [--loss %%] [--reorder %%]\n"
+            "          [--reorder-depth n] [--burst n] [--no-gps] [--dual]\n"
+            "          [--seed n] [--pcap file] [--start-time t]\n", name);
+  }
+
+  bool parseOptions(int argc, char **argv, Options &opts)
+  {
+    static struct option long_options[] = {
+      {"host", required_argument, 0, 'h'},
+      {"port", required_argument, 0, 'p'},
+      {"sensors", required_argument, 0, 'n'},
+      {"rpm", required_argument, 0, 'r'},
+      {"rate", required_argument, 0, 'R'},
+      {"duration", required_argument, 0, 'd'},
+      {"loss", required_argument, 0, 'l'},
+      {"reorder", required_argument, 0, 'o'},
+      {"reorder-depth", required_argument, 0, 'D'},
+      {"burst", required_argument, 0, 'b'},
+      {"no-gps", no_argument, 0, 'G'},
+      {"dual", no_argument, 0, 'u'},
+      {"seed", required_argument, 0, 's'},
+      {"pcap", required_argument, 0, 'f'},
+      {"start-time", required_argument, 0, 't'},
+      {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+      {
+        switch (c)
+          {
+          case 'h': opts.host = optarg; break;
+          case 'p': opts.port = atoi(optarg); break;
+          case 'n': opts.sensors = atoi(optarg); break;
+          case 'r': opts.rpm = atof(optarg); break;
+          case 'R': opts.rate = atof(optarg); break;
+          case 'd': opts.duration = atof(optarg); break;
+          case 'l': opts.loss = atof(optarg); break;
+          case 'o': opts.reorder = atof(optarg); break;
+          case 'D': opts.reorder_depth = atoi(optarg); break;
+          case 'b': opts.burst = atoi(optarg); break;
+          case 'G': opts.gps = false; break;
+          case 'u': opts.dual = true; break;
+          case 's': opts.seed = strtoul(optarg, NULL, 0); break;
+          case 'f': opts.pcap = optarg; break;
+          case 't': opts.start_time = atof(optarg); break;
+          default: return false;
+          }
+      }
+
+    // the device sends twice the packets in dual return mode
+    if (opts.rate == 0.0)
+      opts.rate = opts.dual ? 2 * pandar_tools::PACKET_RATE
+                            : pandar_tools::PACKET_RATE;
+    if (optind != argc || opts.sensors < 1 || opts.rate <= 0.0
+        || opts.rpm <= 0.0 || opts.reorder_depth < 1 || opts.burst < 1)
+      return false;
+    if (!opts.pcap.empty() && opts.duration <= 0.0)
+      {
+        fprintf(stderr, "--pcap needs a --duration\n");
+        return false;
+      }
+    return true;
+  }
+
+  void printStats(const std::vector<Sensor> &sensors, double elapsed)
+  {
+    for (size_t i = 0; i < sensors.size(); ++i)
+      {
+        const Sensor &s = sensors[i];
+        fprintf(stderr, "port %d: %.0f packets/s, sent %llu, dropped %llu, "
+                "reordered %llu, gps %llu\n", s.port, s.sent / elapsed,
+                (unsigned long long) s.sent,
+                (unsigned long long) s.dropped,
+                (unsigned long long) s.reordered,
+                (unsigned long long) s.gps_sent);
+      }
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options opts;
+  if (!parseOptions(argc, argv, opts))
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+  Output out;
+  if (opts.pcap.empty() ? !out.openSocket(opts.host)
+                        : !out.openPcap(opts.pcap))
+    return 1;
+
+  // the simulated PPS counters start in step with the wall clock
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  if (opts.start_time > 0.0)
+    {
+      wall.tv_sec = (time_t) opts.start_time;
+      wall.tv_nsec = (long) ((opts.start_time - wall.tv_sec) * 1e9);
+    }
+  double wall_start = wall.tv_sec + wall.tv_nsec * 1e-9;
+  std::vector<Sensor> sensors;
+  for (int i = 0; i < opts.sensors; ++i)
+    sensors.push_back(Sensor(opts, i, wall.tv_sec, wall.tv_nsec / 1000));
+
+  uint32_t rng = opts.seed ? opts.seed : 1;
+  uint64_t total = opts.duration > 0.0 ?
+    (uint64_t) (opts.duration * opts.rate) : 0;
+  double start = monotonicNow();
+  double last_report = start;
+  uint64_t generated = 0;
+
+  while (total == 0 || generated < total)
+    {
+      uint64_t due;
+      if (opts.pcap.empty())
+        {
+          // release packets in whole bursts, at the average rate
+          double now = monotonicNow();
+          due = (uint64_t) ((now - start) * opts.rate);
+          due -= due % opts.burst;
+          if (now - last_report >= 1.0)
+            {
+              printStats(sensors, now - start);
+              last_report = now;
+            }
+        }
+      else
+        {
+          due = generated + opts.burst;
+        }
+      if (total && due > total)
+        due = total;
+
+      for (; generated < due; ++generated)
+        {
+          double stamp = wall_start + generated / opts.rate;
+          for (size_t i = 0; i < sensors.size(); ++i)
+            emit(opts, out, sensors[i], rng, stamp);
+        }
+
+      if (opts.pcap.empty())
+        {
+          // sleep until the next packet, or burst, is due
+          double next = start + (due + opts.burst) / opts.rate;
+          double wait = next - monotonicNow();
+          if (wait > 0.0)
+            usleep((useconds_t) (wait * 1e6));
+        }
+    }
+
+  for (size_t i = 0; i < sensors.size(); ++i)
+    flush(out, sensors[i], wall_start + total / opts.rate);
+
+  printStats(sensors, opts.pcap.empty() ?
+             monotonicNow() - start : total / opts.rate);
+  return 0;
+}